@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstdint>
 #include <vector>
 #include <memory>
 #include <bw64/bw64.hpp>
@@ -14,6 +15,9 @@ namespace motioncam {
         AudioWriter(std::vector<uint8_t>& output, int numChannels, int sampleRate, int fpsNum, int fpsDen);
 
         void write(const std::vector<int16_t>& data, int numFrames);
+
+        // Generates everything that comes before the samples of a file holding dataSize bytes of 16 bit audio
+        static std::vector<uint8_t> writeHeader(int numChannels, int sampleRate, int fpsNum, int fpsDen, uint64_t dataSize);
         
     private:
         const int mFd;
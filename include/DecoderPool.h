@@ -0,0 +1,66 @@
+#pragma once
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace motioncam {
+
+class Decoder;
+
+//
+// Decoders for one source file, owned by its mount. Each decoder keeps the file open and holds its own buffers, so
+// the pool opens at most maxDecoders of them, hands them out to one task at a time and closes them all when the
+// last lease and the mount are gone.
+//
+
+class DecoderPool : public std::enable_shared_from_this<DecoderPool> {
+public:
+    // Returns the decoder to the pool when it goes out of scope
+    class Lease {
+    public:
+        Lease(Lease&& other) noexcept = default;
+        Lease& operator=(Lease&& other) = delete;
+        ~Lease();
+
+        Decoder& operator*() const { return *mDecoder; }
+        Decoder* operator->() const { return mDecoder.get(); }
+
+    private:
+        friend class DecoderPool;
+
+        Lease(std::shared_ptr<DecoderPool> pool, std::unique_ptr<Decoder> decoder);
+
+        std::shared_ptr<DecoderPool> mPool;
+        std::unique_ptr<Decoder> mDecoder;
+    };
+
+    static std::shared_ptr<DecoderPool> create(const std::string& path, size_t maxDecoders);
+
+    ~DecoderPool();
+
+    DecoderPool(const DecoderPool&) = delete;
+    DecoderPool& operator=(const DecoderPool&) = delete;
+
+    // Takes an idle decoder, opens a new one if the pool is below its limit, otherwise waits for one to be returned
+    Lease acquire();
+
+    const std::string& path() const;
+
+private:
+    DecoderPool(const std::string& path, size_t maxDecoders);
+
+    void release(std::unique_ptr<Decoder> decoder);
+
+private:
+    const std::string mPath;
+    const size_t mMaxDecoders;
+    std::vector<std::unique_ptr<Decoder>> mIdle;
+    size_t mOpen;
+    std::mutex mMutex;
+    std::condition_variable mReleased;
+};
+
+} // namespace motioncam
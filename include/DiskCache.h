@@ -0,0 +1,107 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace motioncam {
+
+// Entries are addressed by content. The source identity changes when the file changes and the render id when the
+// options do, so entries never have to be invalidated, they just stop being read and age out.
+struct DiskCacheKey {
+    uint64_t source;
+    uint64_t render;
+    int64_t frameIndex;
+
+    uint64_t hash() const;
+
+    bool operator==(const DiskCacheKey& other) const {
+        return frameIndex == other.frameIndex &&
+               render == other.render &&
+               source == other.source;
+    }
+};
+
+// Read-only view of the segments of a frame on disk, the file stays mapped for as long as the view is alive
+class DiskCacheFrame {
+public:
+    size_t numSegments() const { return mSegments.size(); }
+    const char* segmentData(size_t segment) const { return mSegments[segment].first; }
+    size_t segmentSize(size_t segment) const { return mSegments[segment].second; }
+
+private:
+    friend class DiskCache;
+
+    std::shared_ptr<const void> mMapping;
+    std::vector<std::pair<const char*, size_t>> mSegments;
+};
+
+//
+// Second cache tier that keeps rendered frames on disk, so they are still around after the memory cache evicts
+// them or the app restarts. Each frame is one file holding all of its segments, written under a temporary name,
+// flushed and renamed into place, and the index is rebuilt from the folder in the background when it is set, so a
+// crash can at worst leave temporary files behind. Frames are read back through a memory mapping that the views
+// share, and checked against their key and size before they are returned.
+//
+
+class DiskCache {
+public:
+    explicit DiskCache(size_t maxSize);
+    ~DiskCache();
+
+    DiskCache(const DiskCache&) = delete;
+    DiskCache& operator=(const DiskCache&) = delete;
+
+    // Sets the folder the entries live in, an empty path disables the cache. What is already there is indexed on a
+    // background thread, the cache stays disabled until that is done.
+    void setFolder(const std::string& path);
+    bool enabled() const;
+
+    // Returns nullptr if the frame is not on disk
+    std::shared_ptr<const DiskCacheFrame> get(const DiskCacheKey& key);
+    void put(const DiskCacheKey& key, const std::vector<std::shared_ptr<std::vector<char>>>& segments);
+
+    size_t size() const;
+    size_t capacity() const;
+
+    // Identifies a source file by its path, size and modification time
+    static uint64_t getSourceId(const std::string& path);
+
+private:
+    struct Entry {
+        uint64_t hash;
+        size_t size;
+    };
+
+    using EntryList = std::list<Entry>;
+
+    void scanFolder(const std::string& path, uint64_t scanId);
+    void remove(uint64_t hash, const std::string& folder);
+
+    // Must be called with the lock held, returns the files to delete once it is released
+    std::vector<std::string> evict();
+
+    // Must be called with the lock held
+    void closeFrame(uint64_t hash);
+
+private:
+    const size_t mMaxSize;
+    std::string mFolder;
+    EntryList mEntries; // Most recently used at the front
+    std::unordered_map<uint64_t, EntryList::iterator> mIndex;
+    std::list<std::pair<uint64_t, std::shared_ptr<const DiskCacheFrame>>> mOpenFrames; // Most recently read first
+    size_t mCurrentSize;
+    mutable std::mutex mMutex;
+    std::thread mScanThread;
+    std::atomic<uint64_t> mScanId; // Changes when the folder does, older scans stop and drop what they found
+};
+
+} // namespace motioncam
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "Types.h"
+
+#include <cstdint>
+#include <functional>
+#include <string>
+
+namespace motioncam {
+
+struct ExportStats {
+    size_t frames;          // Frames rendered, dropped frames are written again without rendering
+    size_t totalFrames;
+    size_t files;
+    uint64_t bytes;
+    double seconds;
+
+    double framesPerSecond() const {
+        return seconds > 0 ? frames / seconds : 0;
+    }
+};
+
+//
+// Writes the files a mount would show to a folder, without going through the file system. Frames are decoded,
+// rendered and written in overlapping stages on separate thread pools, and only as many frames as fit in the
+// memory budget are in flight at once.
+//
+
+class DngExporter {
+public:
+    DngExporter(const std::string& srcFile, const std::string& outputPath, FileRenderOptions options, int draftScale);
+
+    // Called from the writer threads, one call at a time
+    using ProgressCallback = std::function<void(const ExportStats&)>;
+
+    ExportStats run(ProgressCallback onProgress = nullptr);
+
+private:
+    const std::string mSrcFile;
+    const std::string mOutputPath;
+    const FileRenderOptions mOptions;
+    const int mDraftScale;
+};
+
+} // namespace motioncam
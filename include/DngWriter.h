@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace motioncam {
+
+enum DngTag : uint16_t {
+    DNG_TAG_NEW_SUBFILE_TYPE            = 254,
+    DNG_TAG_IMAGE_WIDTH                 = 256,
+    DNG_TAG_IMAGE_LENGTH                = 257,
+    DNG_TAG_BITS_PER_SAMPLE             = 258,
+    DNG_TAG_COMPRESSION                 = 259,
+    DNG_TAG_PHOTOMETRIC                 = 262,
+    DNG_TAG_STRIP_OFFSETS               = 273,
+    DNG_TAG_ORIENTATION                 = 274,
+    DNG_TAG_SAMPLES_PER_PIXEL           = 277,
+    DNG_TAG_ROWS_PER_STRIP              = 278,
+    DNG_TAG_STRIP_BYTE_COUNTS           = 279,
+    DNG_TAG_X_RESOLUTION                = 282,
+    DNG_TAG_Y_RESOLUTION                = 283,
+    DNG_TAG_PLANAR_CONFIG               = 284,
+    DNG_TAG_SOFTWARE                    = 305,
+    DNG_TAG_CFA_REPEAT_PATTERN_DIM      = 33421,
+    DNG_TAG_CFA_PATTERN                 = 33422,
+    DNG_TAG_EXPOSURE_TIME               = 33434,
+    DNG_TAG_ISO_SPEED_RATINGS           = 34855,
+    DNG_TAG_DNG_VERSION                 = 50706,
+    DNG_TAG_DNG_BACKWARD_VERSION        = 50707,
+    DNG_TAG_UNIQUE_CAMERA_MODEL         = 50708,
+    DNG_TAG_CFA_LAYOUT                  = 50711,
+    DNG_TAG_BLACK_LEVEL_REPEAT_DIM      = 50713,
+    DNG_TAG_BLACK_LEVEL                 = 50714,
+    DNG_TAG_WHITE_LEVEL                 = 50717,
+    DNG_TAG_COLOR_MATRIX1               = 50721,
+    DNG_TAG_COLOR_MATRIX2               = 50722,
+    DNG_TAG_CAMERA_CALIBRATION1         = 50723,
+    DNG_TAG_CAMERA_CALIBRATION2         = 50724,
+    DNG_TAG_AS_SHOT_NEUTRAL             = 50728,
+    DNG_TAG_CALIBRATION_ILLUMINANT1     = 50778,
+    DNG_TAG_CALIBRATION_ILLUMINANT2     = 50779,
+    DNG_TAG_ACTIVE_AREA                 = 50829,
+    DNG_TAG_FORWARD_MATRIX1             = 50964,
+    DNG_TAG_FORWARD_MATRIX2             = 50965,
+    DNG_TAG_TIME_CODES                  = 51043,
+    DNG_TAG_FRAME_RATE                  = 51044
+};
+
+//
+// Writes little endian DNGs holding a single uncompressed CFA image in one strip.
+// The TIFF header, IFD and tag data come first and the pixel data starts at headerSize(), so
+// the caller can allocate the whole file once and render the pixels straight into place.
+//
+
+class DngWriter {
+public:
+    DngWriter(uint32_t width, uint32_t height, uint16_t bitsPerSample);
+
+    void setByte(DngTag tag, const uint8_t* values, uint32_t count);
+    void setAscii(DngTag tag, const std::string& value);
+    void setShort(DngTag tag, const uint16_t* values, uint32_t count);
+    void setShort(DngTag tag, uint16_t value);
+    void setLong(DngTag tag, const uint32_t* values, uint32_t count);
+    void setLong(DngTag tag, uint32_t value);
+    void setRational(DngTag tag, const float* values, uint32_t count);
+    void setRational(DngTag tag, uint32_t numerator, uint32_t denominator);
+    void setSRational(DngTag tag, const float* values, uint32_t count);
+    void setSRational(DngTag tag, int32_t numerator, int32_t denominator);
+
+    // Offset of the pixel data, page aligned
+    size_t headerSize() const;
+    size_t imageSize() const;
+    size_t fileSize() const;
+
+    // Writes everything before the pixel data, dst must hold headerSize() bytes
+    void writeHeader(uint8_t* dst) const;
+
+private:
+    struct Tag {
+        uint16_t type;
+        uint32_t count;
+        std::vector<uint8_t> data;
+    };
+
+    void setTag(DngTag tag, uint16_t type, uint32_t count, std::vector<uint8_t> data);
+
+private:
+    std::map<uint16_t, Tag> mTags;
+    uint32_t mWidth;
+    uint32_t mHeight;
+    uint16_t mBitsPerSample;
+};
+
+} // namespace motioncam
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstddef>
 #include <string>
 #include <optional>
 
@@ -19,6 +20,16 @@ struct FileInfo {
     int height;
 };
 
+struct CacheStats {
+    size_t memoryCacheSize;
+    size_t memoryCacheCapacity;
+    size_t diskCacheSize;
+    size_t diskCacheCapacity;
+    size_t queuedReads;
+    size_t queuedPrefetches;
+    double averageReadWaitMs;
+};
+
 class IFuseFileSystem {
 public:
     virtual ~IFuseFileSystem() = default;
@@ -31,6 +42,12 @@ public:
     virtual void updateOptions(MountId mountId, FileRenderOptions options, int draftScale) = 0;
     virtual std::optional<FileInfo> getFileInfo(MountId mountId) = 0;
 
+    // Rendered frames are also kept in this folder when set, an empty path disables the disk cache
+    virtual void setDiskCacheFolder(const std::string& path) = 0;
+
+    // Shared by all mounts
+    virtual CacheStats getCacheStats() const = 0;
+
 protected:
     IFuseFileSystem() = default;
 };
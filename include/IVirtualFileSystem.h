@@ -2,6 +2,7 @@
 
 #include "Types.h"
 
+#include <limits>
 #include <optional>
 #include <string>
 #include <vector>
@@ -9,6 +10,10 @@
 
 namespace motioncam {
 
+// Returned by readFile when the read was queued, result is called once it completes. Zero is a read at the end of
+// the file and negative values are errors.
+constexpr int READ_PENDING = (std::numeric_limits<int>::min)();
+
 class IVirtualFileSystem {
 public:
     virtual ~IVirtualFileSystem() = default;
@@ -18,13 +23,15 @@ public:
 
     virtual std::vector<Entry> listFiles(const std::string& filter) const = 0;
     virtual std::optional<Entry> findEntry(const std::string& fullPath) const = 0;
+    // Queued reads for which isCancelled returns true are dropped and complete with ECANCELED
     virtual int readFile(
         const Entry& entry,
         const size_t pos,
         const size_t len,
         void* dst,
         std::function<void(size_t, int)> result,
-        bool async) = 0;
+        bool async,
+        std::function<bool()> isCancelled = nullptr) = 0;
 
     virtual void updateOptions(FileRenderOptions options, int draftScale) = 0;
 
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace motioncam {
+namespace kernels {
+
+// Per-column parameters for one row of 2x2 Bayer blocks, indexed by [even column, odd column]
+struct LinearizeParams {
+    float linear[2];
+    float srcBlackLevel[2];
+    float dstBlackLevel[2];
+    float dstRange[2];
+    float dstWhiteLevel;
+};
+
+// Linearises a row of raw samples, applies the per-pixel gain (treated as 1 when gain is null) and
+// rescales to the destination black/white levels. Results are bit-exact with the scalar path.
+void linearizeRow(
+    const uint16_t* src,
+    const float* gain,
+    uint16_t* dst,
+    size_t count,
+    const LinearizeParams& params);
+
+// Packs a row of samples MSB-first at 10, 12, 14 or 16 bits per sample, the layout of uncompressed DNG strips.
+// count must be a multiple of 4 and every sample must fit in the requested number of bits.
+void packRow(
+    const uint16_t* src,
+    uint8_t* dst,
+    size_t count,
+    int bits);
+
+// Name of the instruction set selected at runtime
+const char* activeInstructionSet();
+
+} // namespace kernels
+} // namespace motioncam
@@ -1,143 +1,223 @@
 #pragma once
 
+#include <algorithm>
+#include <cstdint>
 #include <vector>
 #include <unordered_map>
-#include <unordered_set>
 #include <list>
 #include <mutex>
+#include <shared_mutex>
+#include <atomic>
 #include <memory>
-
-#include "Types.h"
+#include <future>
 
 #include <spdlog/spdlog.h>
 
 namespace motioncam {
 
+// Files are cached in independently rendered segments, keys are plain integers so cache operations never touch
+// strings. The generation changes with the render options so renders with old options are never returned.
+struct CacheKey {
+    uint32_t mountId;
+    uint32_t generation;
+    int64_t frameIndex;
+    int64_t segment;
+
+    struct Hash {
+        size_t operator()(const CacheKey& key) const {
+            uint64_t hash = (static_cast<uint64_t>(key.mountId) << 32) | key.generation;
+
+            hash = (hash ^ static_cast<uint64_t>(key.frameIndex)) * 0x9E3779B97F4A7C15ull;
+            hash = (hash ^ static_cast<uint64_t>(key.segment)) * 0xBF58476D1CE4E5B9ull;
+
+            return static_cast<size_t>(hash ^ (hash >> 31));
+        }
+    };
+
+    bool operator==(const CacheKey& other) const {
+        return segment == other.segment &&
+               frameIndex == other.frameIndex &&
+               generation == other.generation &&
+               mountId == other.mountId;
+    }
+};
+
+//
+// Keys are partitioned into shards by hash, each shard has its own lock, LRU list and an equal share of the
+// byte budget so threads working on different keys rarely contend. Hits only set a referenced bit under a shared
+// lock, eviction gives referenced entries a second chance, which approximates LRU without writes on the hit path.
+//
+
 class LRUCache {
 public:
-    explicit LRUCache(size_t maxSize) : mMaxSize(maxSize), mCurrentSize(0) {}
+    static constexpr size_t DEFAULT_SHARDS = 16;
+
+    explicit LRUCache(size_t maxSize, size_t numShards = DEFAULT_SHARDS) :
+        mMaxSize(maxSize),
+        mNumShards((std::max)(numShards, static_cast<size_t>(1))),
+        mShards(new Shard[mNumShards])
+    {
+        for(size_t i = 0; i < mNumShards; ++i)
+            mShards[i].maxSize = mMaxSize / mNumShards;
+    }
 
-    // Get value from cache, returns nullptr if not found
-    // If another thread is already processing the same key, this thread will wait
-    std::shared_ptr<std::vector<char>> get(const Entry& key, std::chrono::milliseconds timeout = std::chrono::seconds(2)) {
-        std::unique_lock<std::mutex> lock(mMutex);
+    // Get value from cache. If another thread is producing the same key, waits for it and returns its value.
+    // Returns nullptr when the key is neither cached nor in progress; the caller then owns producing it and must
+    // call put() or markLoadFailed(), every other caller for that key waits on the result.
+    std::shared_ptr<std::vector<char>> get(const CacheKey& key) {
+        auto& shard = getShard(key);
 
-        // Wait if another thread is currently processing this key, with timeout
-        bool success = mCondition.wait_for(lock, timeout, [this, &key] {
-            return mInProgress.find(key) == mInProgress.end();
-        });
+        // Hits only need the shared lock
+        if (auto value = peek(key))
+            return value;
 
-        if (!success) {
-            // Timeout occurred - another thread is taking too long
-            spdlog::warn("Timeout waiting for key to be processed by another thread");
-            return nullptr;
-        }
+        while(true) {
+            std::shared_future<Value> pending;
 
-        auto it = mCacheMap.find(key);
-        if (it == mCacheMap.end()) {
-            // Cache miss - mark as in progress so other threads wait
-            mInProgress.insert(key);
-            lock.unlock();
+            {
+                std::unique_lock<std::shared_mutex> lock(shard.mutex);
 
-            // Notify that this key is now being processed
-            // (Other threads will wait in the condition above)
+                auto it = shard.cacheMap.find(key);
+                if (it != shard.cacheMap.end()) {
+                    it->second->referenced.store(true, std::memory_order_relaxed);
+                    return it->second->value;
+                }
 
-            // Return nullptr to indicate cache miss
-            // The caller should handle loading the data and calling put()
-            return nullptr;
+                auto inProgressIt = shard.inProgress.find(key);
+                if (inProgressIt == shard.inProgress.end()) {
+                    // Cache miss - claim the key so other threads wait for this one
+                    shard.inProgress.emplace(key, InProgress());
+                    return nullptr;
+                }
+
+                pending = inProgressIt->second.result;
+            }
+
+            // Only waiters for this key wake up, and they get the value directly
+            auto value = pending.get();
+            if (value)
+                return value;
+
+            // Producer failed, try to claim the key again
         }
+    }
+
+    // Get value from cache without waiting on or claiming in-progress keys, returns nullptr if not found.
+    // This is the hit path: one shared lock, a lookup and setting the referenced bit, readers don't block each other.
+    std::shared_ptr<std::vector<char>> peek(const CacheKey& key) {
+        auto& shard = getShard(key);
+        std::shared_lock<std::shared_mutex> lock(shard.mutex);
+
+        auto it = shard.cacheMap.find(key);
+        if (it == shard.cacheMap.end())
+            return nullptr;
+
+        it->second->referenced.store(true, std::memory_order_relaxed);
 
-        // Cache hit, move to front of list (most recently used)
-        mCacheList.splice(mCacheList.begin(), mCacheList, it->second);
+        return it->second->value;
+    }
+
+    // Like peek(), but doesn't count as a hit, for background work that reads entries nobody asked for
+    std::shared_ptr<std::vector<char>> inspect(const CacheKey& key) const {
+        auto& shard = getShard(key);
+        std::shared_lock<std::shared_mutex> lock(shard.mutex);
+
+        auto it = shard.cacheMap.find(key);
+        if (it == shard.cacheMap.end())
+            return nullptr;
 
-        return it->second->second;
+        return it->second->value;
     }
 
     // Add or update value in cache
-    void put(const Entry& key, std::shared_ptr<std::vector<char>> value) {
-        std::lock_guard<std::mutex> lock(mMutex);
+    void put(const CacheKey& key, std::shared_ptr<std::vector<char>> value) {
+        auto& shard = getShard(key);
+        std::unique_lock<std::shared_mutex> lock(shard.mutex);
 
         size_t valueSize = value->size();
 
         // Check if key already exists in cache
-        auto it = mCacheMap.find(key);
+        auto it = shard.cacheMap.find(key);
 
-        if (it != mCacheMap.end()) {
+        if (it != shard.cacheMap.end()) {
             // Update value
-            size_t oldSize = it->second->second->size();
-            mCurrentSize -= oldSize;
-            mCurrentSize += valueSize;
+            shard.currentSize -= it->second->value->size();
+            shard.currentSize += valueSize;
 
             // Move to front and update
-            mCacheList.splice(mCacheList.begin(), mCacheList, it->second);
-            it->second->second = value;
+            shard.cacheList.splice(shard.cacheList.begin(), shard.cacheList, it->second);
+            it->second->value = value;
         }
-        else {
-            // New entry
-
-            // If adding this would exceed max size, remove older entries
-            while (!mCacheList.empty() && (mCurrentSize + valueSize > mMaxSize)) {
-                auto last = mCacheList.back();
-                mCurrentSize -= last.second->size();
-                mCacheMap.erase(last.first);
-                mCacheList.pop_back();
-            }
-
-            // If the single item is too large for the cache, don't add it
-            if (valueSize > mMaxSize) {
-                // Remove from in-progress set and notify waiting threads
-                mInProgress.erase(key);
-                mCondition.notify_all();
-                return;
+        else if (valueSize <= shard.maxSize) {
+            // If adding this would exceed the shard budget, remove older entries. Entries that were hit since they
+            // were last looked at get a second chance at the front instead, so hits never have to reorder the list.
+            while (!shard.cacheList.empty() && (shard.currentSize + valueSize > shard.maxSize)) {
+                auto last = std::prev(shard.cacheList.end());
+
+                if (last->referenced.exchange(false, std::memory_order_relaxed)) {
+                    shard.cacheList.splice(shard.cacheList.begin(), shard.cacheList, last);
+                    continue;
+                }
+
+                shard.currentSize -= last->value->size();
+                shard.cacheMap.erase(last->key);
+                shard.cacheList.erase(last);
             }
 
             // Add new entry
-            mCacheList.emplace_front(key, value);
-            mCacheMap[key] = mCacheList.begin();
-            mCurrentSize += valueSize;
+            shard.cacheList.emplace_front(key, value);
+            shard.cacheMap[key] = shard.cacheList.begin();
+            shard.currentSize += valueSize;
         }
 
-        // Remove from in-progress set and notify waiting threads
-        mInProgress.erase(key);
-        mCondition.notify_all();
-
-        spdlog::debug("Cache size is {} bytes", mCurrentSize);
+        // Hand the value to threads waiting on this key
+        completeInProgress(shard, key, value);
     }
 
     // Remove an entry from the cache
-    void remove(const Entry& key) {
-        std::lock_guard<std::mutex> lock(mMutex);
+    void remove(const CacheKey& key) {
+        auto& shard = getShard(key);
+        std::unique_lock<std::shared_mutex> lock(shard.mutex);
 
-        auto it = mCacheMap.find(key);
+        auto it = shard.cacheMap.find(key);
 
-        if (it != mCacheMap.end()) {
-            mCurrentSize -= it->second->second->size();
-            mCacheList.erase(it->second);
-            mCacheMap.erase(it);
+        if (it != shard.cacheMap.end()) {
+            shard.currentSize -= it->second->value->size();
+            shard.cacheList.erase(it->second);
+            shard.cacheMap.erase(it);
         }
 
-        // Also remove from in-progress set if present and notify
-        if (mInProgress.erase(key) > 0) {
-            mCondition.notify_all();
-        }
+        // Also release threads waiting on the key if it is in progress
+        completeInProgress(shard, key, nullptr);
     }
 
     // Clear the cache
     void clear() {
-        std::lock_guard<std::mutex> lock(mMutex);
+        for(size_t i = 0; i < mNumShards; ++i) {
+            auto& shard = mShards[i];
+            std::unique_lock<std::shared_mutex> lock(shard.mutex);
+
+            shard.cacheMap.clear();
+            shard.cacheList.clear();
+            shard.currentSize = 0;
 
-        mCacheMap.clear();
-        mCacheList.clear();
-        mInProgress.clear();
-        mCurrentSize = 0;
-        mCondition.notify_all();
+            for (auto& item : shard.inProgress)
+                item.second.promise.set_value(nullptr);
+
+            shard.inProgress.clear();
+        }
     }
 
     // Get current size
     size_t size() const {
-        std::lock_guard<std::mutex> lock(mMutex);
+        size_t currentSize = 0;
 
-        return mCurrentSize;
+        for(size_t i = 0; i < mNumShards; ++i) {
+            std::shared_lock<std::shared_mutex> lock(mShards[i].mutex);
+            currentSize += mShards[i].currentSize;
+        }
+
+        return currentSize;
     }
 
     // Get maximum size
@@ -146,25 +226,66 @@ public:
     }
 
     // Method to mark that processing for a key has failed
-    // This should be called if the caller gets nullptr from get() but fails to load the data
-    void markLoadFailed(const Entry& key) {
-        std::lock_guard<std::mutex> lock(mMutex);
-        mInProgress.erase(key);
-        mCondition.notify_all();
+    // This should be called if the caller gets nullptr from get() but fails to load the data, one of the
+    // waiting threads then claims the key
+    void markLoadFailed(const CacheKey& key) {
+        auto& shard = getShard(key);
+        std::unique_lock<std::shared_mutex> lock(shard.mutex);
+
+        completeInProgress(shard, key, nullptr);
     }
 
 private:
-    using CacheItem = std::pair<Entry, std::shared_ptr<std::vector<char>>>;
+    using Value = std::shared_ptr<std::vector<char>>;
+
+    struct CacheItem {
+        CacheItem(const CacheKey& key, Value value) : key(key), value(std::move(value)), referenced(false) {}
+
+        CacheKey key;
+        Value value;
+        std::atomic<bool> referenced; // Set by hits, checked on eviction
+    };
+
     using CacheList = std::list<CacheItem>;
-    using CacheMap = std::unordered_map<Entry, typename CacheList::iterator, Entry::Hash>;
-
-    CacheList mCacheList; // List of cache entries, most recently used at the front
-    CacheMap mCacheMap;   // Map from key to list iterator
-    std::unordered_set<Entry, Entry::Hash> mInProgress; // Set of keys currently being processed
-    size_t mMaxSize;      // Maximum cache size in bytes
-    size_t mCurrentSize;  // Current cache size in bytes
-    mutable std::mutex mMutex; // Mutex for thread safety
-    mutable std::condition_variable mCondition; // Condition variable for waiting
+    using CacheMap = std::unordered_map<CacheKey, typename CacheList::iterator, CacheKey::Hash>;
+
+    struct InProgress {
+        InProgress() : result(promise.get_future().share()) {}
+
+        std::promise<Value> promise;
+        std::shared_future<Value> result;
+    };
+
+    struct Shard {
+        CacheList cacheList; // List of cache entries, most recently inserted or second-chanced at the front
+        CacheMap cacheMap;   // Map from key to list iterator
+        std::unordered_map<CacheKey, InProgress, CacheKey::Hash> inProgress; // Keys currently being processed
+        size_t maxSize = 0;      // Maximum shard size in bytes
+        size_t currentSize = 0;  // Current shard size in bytes
+        mutable std::shared_mutex mutex; // Shared for lookups, exclusive for changes
+    };
+
+    // Must be called with the shard locked
+    static void completeInProgress(Shard& shard, const CacheKey& key, Value value) {
+        auto it = shard.inProgress.find(key);
+        if (it == shard.inProgress.end())
+            return;
+
+        it->second.promise.set_value(std::move(value));
+        shard.inProgress.erase(it);
+    }
+
+    Shard& getShard(const CacheKey& key) const {
+        // Mix the hash so keys that only differ in the low bits still spread across shards
+        const uint64_t hash = static_cast<uint64_t>(CacheKey::Hash{}(key)) * 0x9E3779B97F4A7C15ull;
+
+        return mShards[(hash >> 32) % mNumShards];
+    }
+
+private:
+    const size_t mMaxSize;    // Maximum cache size in bytes
+    const size_t mNumShards;
+    std::unique_ptr<Shard[]> mShards;
 };
 
 }
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace motioncam {
+
+enum TaskPriority : int {
+    TASK_PRIORITY_FOREGROUND = 0,   // Reads someone is waiting for
+    TASK_PRIORITY_PREFETCH = 1,     // Speculative work, only runs when no foreground task is queued
+
+    TASK_PRIORITY_COUNT
+};
+
+struct TaskQueueStats {
+    size_t queued;
+    size_t running;
+    uint64_t completed;
+    uint64_t cancelled;
+    double averageWaitMs;   // Time tasks spent queued, weighted towards recent tasks
+};
+
+//
+// Thread pool that always runs the highest priority task first, tasks of the same priority run in the order they
+// were submitted so no read waits forever behind newer ones. When the user scrubs, the reads for frames they have
+// skipped past are cancelled by the file system while they are queued, they are checked once more right before they
+// would start.
+//
+
+class TaskScheduler {
+public:
+    explicit TaskScheduler(const std::string& name, unsigned int numThreads = 0);
+    ~TaskScheduler();
+
+    TaskScheduler(const TaskScheduler&) = delete;
+    TaskScheduler& operator=(const TaskScheduler&) = delete;
+
+    // If isCancelled returns true when the task is about to start, onCancel runs instead of the task
+    void submit(
+        TaskPriority priority,
+        std::function<void()> task,
+        std::function<bool()> isCancelled = nullptr,
+        std::function<void()> onCancel = nullptr);
+
+    template<typename F, typename R = std::invoke_result_t<std::decay_t<F>>>
+    std::future<R> submitTask(TaskPriority priority, F&& task) {
+        auto packagedTask = std::make_shared<std::packaged_task<R()>>(std::forward<F>(task));
+        auto future = packagedTask->get_future();
+
+        submit(priority, [packagedTask]() { (*packagedTask)(); });
+
+        return future;
+    }
+
+    // Waits until every queued task has run
+    void wait();
+
+    unsigned int getThreadCount() const;
+    TaskQueueStats getStats(TaskPriority priority) const;
+
+private:
+    struct Task {
+        std::function<void()> run;
+        std::function<bool()> isCancelled;
+        std::function<void()> onCancel;
+        std::chrono::steady_clock::time_point queuedTime;
+    };
+
+    struct Queue {
+        std::deque<Task> tasks;
+        TaskQueueStats stats{};
+    };
+
+    void workerMain();
+    bool isIdle() const;
+
+private:
+    const std::string mName;
+    std::array<Queue, TASK_PRIORITY_COUNT> mQueues;
+    std::vector<std::thread> mThreads;
+    mutable std::mutex mMutex;
+    std::condition_variable mTaskAvailable;
+    std::condition_variable mIdle;
+    bool mStopping;
+};
+
+} // namespace motioncam
@@ -14,12 +14,18 @@ enum EntryType : int {
     INVALID_ENTRY = -1
 };
 
+// Location of a frame in the source container, resolved once when the entries are created
+struct FrameReference {
+    int64_t timestamp;
+    int64_t frameIndex;
+};
+
 struct Entry {
     EntryType type;
     std::vector<std::string> pathParts;
     std::string name;
     size_t size;
-    std::variant<int64_t> userData;
+    std::variant<int64_t, FrameReference> userData;
 
     // Custom hash function for Entry
     struct Hash {
@@ -3,22 +3,34 @@
 #include <IVirtualFileSystem.h>
 #include <IFuseFileSystem.h>
 
-namespace BS {
-class thread_pool;
-}
+#include "CameraFrameMetadata.h"
+#include "DecoderPool.h"
+#include "DiskCache.h"
+#include "LRUCache.h"
+#include "TaskScheduler.h"
+#include "Utils.h"
 
-namespace motioncam {
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <future>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
 
-class Decoder;
-class LRUCache;
+namespace motioncam {
 
 class VirtualFileSystemImpl_MCRAW : public IVirtualFileSystem
 {
 public:
     VirtualFileSystemImpl_MCRAW(
-        BS::thread_pool& ioThreadPool,
-        BS::thread_pool& processingThreadPool,
+        TaskScheduler& ioThreadPool,
+        TaskScheduler& processingThreadPool,
         LRUCache& lruCache,
+        DiskCache& diskCache,
         FileRenderOptions options,
         int draftScale,
         const std::string& file);
@@ -34,48 +46,184 @@ public:
         const size_t len,
         void* dst,
         std::function<void(size_t, int)> result,
-        bool async=true) override;
+        bool async=true,
+        std::function<bool()> isCancelled=nullptr) override;
 
     void updateOptions(FileRenderOptions options, int draftScale) override;
     
     FileInfo getFileInfo() const;
 
 private:
-    void init(FileRenderOptions options);
+    // Everything that depends on the render options. It is never modified once published, updateOptions builds a
+    // new one and swaps it in, so a read sees the layout, cache generation and file sizes of one set of options.
+    struct RenderState {
+        FileRenderOptions options;
+        int draftScale;
+        uint32_t generation;
+        utils::DngLayout layout;
+        std::vector<Entry> files;
+    };
+
+    void init(FileRenderOptions options, int draftScale);
+    void buildFileIndex(const std::vector<Entry>& files);
+
+    std::shared_ptr<const RenderState> getState() const;
+
+    // Must be called with mMutex held
+    std::shared_ptr<const RenderState> buildState(FileRenderOptions options, int draftScale, std::vector<Entry> files);
+
+    struct DecodedFrame {
+        CameraFrameMetadata metadata;
+        std::vector<uint8_t> data;
+    };
+
+    // A decode can be submitted again at a higher priority, whichever submission starts first runs it
+    struct DecodeJob {
+        std::promise<std::shared_ptr<const DecodedFrame>> promise;
+        std::atomic<bool> started{false};
+        TaskPriority priority;
+    };
+
+    struct PendingDecode {
+        int64_t timestamp;
+        std::shared_future<std::shared_ptr<const DecodedFrame>> result;
+        std::shared_ptr<DecodeJob> job;
+    };
+
+    // Everything needed to produce the segments of a frame, captured when the read comes in so tasks that are
+    // already queued aren't affected by option changes
+    struct FrameRequest {
+        Entry entry;
+        CacheKey cacheKey;
+        DiskCacheKey diskCacheKey;
+        utils::DngLayout layout;
+        std::shared_ptr<const CameraConfiguration> cameraConfiguration;
+        float fps;
+        FileRenderOptions options;
+        int scale;
+    };
+
+    struct ReadAheadState {
+        int64_t position;        // Last frame read, index into mFrameEntries
+        int64_t next;            // Next frame to prefetch
+        int direction;           // 1 when reading forwards, -1 backwards, 0 when not reading sequentially
+        int sequentialReads;
+        int inFlight;            // Prefetches queued or running
+        double frameIntervalMs;  // Average time the reader spends on a frame
+        double renderTimeMs;     // Average time to render a frame
+        std::chrono::steady_clock::time_point lastReadTime;
+    };
+
+    std::shared_future<std::shared_ptr<const DecodedFrame>> getDecodedFrame(const Entry& entry, TaskPriority priority);
+    void submitDecode(int64_t timestamp, const std::shared_ptr<DecodeJob>& job);
+
+    FrameRequest makeFrameRequest(const RenderState& state, const Entry& entry) const;
+
+    // Gets segments from the memory cache, the disk cache or renders them, in order. Frames are decoded at the given
+    // priority. Returns true if any segment was rendered.
+    bool loadSegments(
+        const FrameRequest& request,
+        int64_t firstSegment,
+        int64_t lastSegment,
+        TaskPriority priority,
+        const std::function<void(int64_t, const char*, size_t)>& consume);
 
-    size_t generateFrame(
+    // Returns nullptr if the frame isn't on disk or doesn't match the layout of the request
+    std::shared_ptr<const DiskCacheFrame> getDiskFrame(const FrameRequest& request);
+
+    // Writes the frame to the disk cache once every segment of it has been rendered
+    void storeFrame(const FrameRequest& request);
+    void storeFrameInBackground(const FrameRequest& request);
+
+    // Returns false if the entry is already being written
+    bool beginDiskWrite(const DiskCacheKey& key);
+    void finishDiskWrite(const DiskCacheKey& key);
+
+    // Detects sequential reads and prefetches the frames that come next
+    void trackRead(const Entry& entry);
+    int64_t getReadAheadDepth() const;
+    void prefetchFrame(const Entry& entry, uint64_t epoch);
+    void finishPrefetch(double renderTimeMs);
+
+    int generateFrame(
         const Entry& entry,
         const size_t pos,
         const size_t len,
         void* dst,
         std::function<void(size_t, int)> result,
-        bool async);
+        bool async,
+        std::function<bool()> isCancelled);
+
+    int generateFrameHeader(
+        const FrameRequest& request,
+        const size_t pos,
+        const size_t len,
+        void* dst,
+        std::function<void(size_t, int)> result,
+        bool async,
+        std::function<bool()> isCancelled);
+
+    // Reads the index of the audio from the disk cache, returns false if it isn't there
+    bool restoreAudioIndex();
+
+    // Returns nullptr if the audio isn't on disk or doesn't match the index
+    std::shared_ptr<const DiskCacheFrame> getDiskAudio();
+
+    // Writes the index and the pages of the audio to the disk cache, the pages are rendered on the IO pool too. Does
+    // nothing if the audio is already being written.
+    void storeAudioInBackground(std::function<std::vector<std::shared_ptr<std::vector<char>>>()> renderPages);
+
+    // Gets the pages of audio samples covering the read from the memory cache, the disk cache or the container, in order
+    void loadAudioPages(
+        int64_t firstPage,
+        int64_t lastPage,
+        const std::function<void(int64_t, const std::vector<char>&)>& consume);
 
-    size_t generateAudio(
+    int generateAudio(
         const Entry& entry,
         const size_t pos,
         const size_t len,
         void* dst,
         std::function<void(size_t, int)> result,
-        bool async);
+        bool async,
+        std::function<bool()> isCancelled);
 
 private:
     LRUCache& mCache;
-    BS::thread_pool& mIoThreadPool;
-    BS::thread_pool& mProcessingThreadPool;
+    DiskCache& mDiskCache;
+    TaskScheduler& mIoThreadPool;
+    TaskScheduler& mProcessingThreadPool;
     const std::string mSrcPath;
+    const std::shared_ptr<DecoderPool> mDecoderPool; // Shared with queued decode tasks, closed once they finish
     const std::string mBaseName;
-    size_t mTypicalDngSize;
-    std::vector<Entry> mFiles;
-    std::vector<uint8_t> mAudioFile;
-    int mDraftScale;
-    FileRenderOptions mOptions;
+    const uint32_t mMountId;
+    const uint64_t mSourceId;
+    CameraFrameMetadata mFirstFrameMetadata; // DNG sizes are derived from it when the options change
+    std::unordered_map<uint64_t, uint32_t> mGenerations; // Cache generation of each set of render options
+    std::shared_ptr<const RenderState> mState;
+    mutable std::mutex mStateLock;
+    std::vector<std::string> mFilePaths;                      // Names don't change with the options, so the index
+    std::unordered_map<std::string_view, size_t> mFileIndex;  // into the files of every state is built once
+    std::vector<uint8_t> mAudioHeader;         // Everything before the samples in audio.wav
+    std::vector<int64_t> mAudioChunkOffsets;   // Where each audio chunk starts in the samples, followed by the end
+    uint64_t mAudioDataSize;
+    std::shared_ptr<const CameraConfiguration> mCameraConfiguration;
     float mFps;
     int mTotalFrames;
     int mDroppedFrames;
     int mWidth;
     int mHeight;
-    std::mutex mMutex;
+    std::mutex mMutex; // Serialises option changes, guards mGenerations
+    std::list<PendingDecode> mDecodedFrames;
+    std::mutex mDecodedFramesLock;
+    std::vector<Entry> mFrameEntries; // One entry per frame, in timestamp order
+    ReadAheadState mReadAhead{ -1, 0, 0, 0, 0, 0, 0, {} };
+    std::unordered_set<uint64_t> mDiskWrites; // Disk cache entries queued or being written, they use this instance too
+    std::atomic<int64_t> mLastReadTimestamp;
+    std::atomic<uint64_t> mReadAheadEpoch; // Changes when the access pattern breaks, queued prefetches check it
+    std::atomic<bool> mStopping;
+    std::mutex mReadAheadLock;
+    std::condition_variable mReadAheadDone;
 };
 
 } // namespace motioncam
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace motioncam {
+
+#ifdef _WIN32
+    using SocketHandle = uintptr_t;
+#else
+    using SocketHandle = int;
+#endif
+
+//
+// Unix domain socket, used by the headless daemon to take commands from the command line. Windows supports them
+// too since Windows 10, so the same code serves every platform.
+//
+
+class LocalSocket {
+public:
+    LocalSocket(LocalSocket&& other) noexcept;
+    LocalSocket& operator=(LocalSocket&& other) noexcept;
+    ~LocalSocket();
+
+    LocalSocket(const LocalSocket&) = delete;
+    LocalSocket& operator=(const LocalSocket&) = delete;
+
+    // Replaces a socket left behind by a daemon that didn't exit cleanly, throws if a daemon is still listening
+    static LocalSocket listen(const std::string& path);
+    static LocalSocket connect(const std::string& path);
+
+    static std::string getDefaultPath();
+
+    // Returns false if no connection arrived within the timeout
+    bool waitForConnection(int timeoutMs);
+    LocalSocket accept();
+
+    // Returns false if the other end closed the connection before a full line arrived
+    bool readLine(std::string& line);
+    void write(const std::string& data);
+
+private:
+    explicit LocalSocket(SocketHandle handle, const std::string& path = "");
+
+    void close();
+
+private:
+    SocketHandle mHandle;
+    std::string mPath; // Only set when listening, the socket file is removed on close
+    std::string mBuffer;
+};
+
+} // namespace motioncam
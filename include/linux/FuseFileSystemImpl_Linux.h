@@ -0,0 +1,37 @@
+#pragma once
+
+#include <map>
+#include <memory>
+
+#include "IFuseFileSystem.h"
+
+namespace motioncam {
+
+struct Session;
+class LRUCache;
+class TaskScheduler;
+class DiskCache;
+
+class FuseFileSystemImpl_Linux : public IFuseFileSystem
+{
+public:
+    FuseFileSystemImpl_Linux();
+    ~FuseFileSystemImpl_Linux();
+
+    MountId mount(FileRenderOptions options, int draftScale, const std::string& srcFile, const std::string& dstPath) override;
+    void unmount(MountId mountId) override;
+    void updateOptions(MountId mountId, FileRenderOptions options, int draftScale) override;
+    std::optional<FileInfo> getFileInfo(MountId mountId) override;
+    void setDiskCacheFolder(const std::string& path) override;
+    CacheStats getCacheStats() const override;
+
+private:
+    MountId mNextMountId;
+    std::map<MountId, std::unique_ptr<Session>> mMountedFiles;
+    std::unique_ptr<TaskScheduler> mIoThreadPool;
+    std::unique_ptr<TaskScheduler> mProcessingThreadPool;
+    std::unique_ptr<LRUCache> mCache;
+    std::unique_ptr<DiskCache> mDiskCache;
+};
+
+} // namespace motioncam
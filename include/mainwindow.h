@@ -75,6 +75,7 @@ private:
     void saveSettings();
     void restoreSettings();
     void updateUi();
+    void updateDiskCache();
 
 private:
     Ui::MainWindow *ui;
@@ -5,14 +5,12 @@
 
 #include "IFuseFileSystem.h"
 
-namespace BS {
-    class thread_pool;
-}
-
 namespace motioncam {
 
 class VirtualizationInstance;
 class LRUCache;
+class TaskScheduler;
+class DiskCache;
 
 class FuseFileSystemImpl_Win : public IFuseFileSystem
 {
@@ -23,13 +21,16 @@ public:
     void unmount(MountId mountId) override;
     void updateOptions(MountId mountId, FileRenderOptions options, int draftScale) override;
     std::optional<FileInfo> getFileInfo(MountId mountId) override;
+    void setDiskCacheFolder(const std::string& path) override;
+    CacheStats getCacheStats() const override;
 
 private:
     MountId mNextMountId;
     std::map<MountId, std::unique_ptr<VirtualizationInstance>> mMountedFiles;
-    std::unique_ptr<BS::thread_pool> mIoThreadPool;
-    std::unique_ptr<BS::thread_pool> mProcessingThreadPool;
+    std::unique_ptr<TaskScheduler> mIoThreadPool;
+    std::unique_ptr<TaskScheduler> mProcessingThreadPool;
     std::unique_ptr<LRUCache> mCache;
+    std::unique_ptr<DiskCache> mDiskCache;
 
 };
 
@@ -1,5 +1,9 @@
 #include "AudioWriter.h"
 
+#include <climits>
+#include <cstdint>
+#include <cstring>
+
 namespace motioncam {
     namespace {
         constexpr auto PROJECT = "RAW Video";
@@ -92,4 +96,46 @@ namespace motioncam {
     void AudioWriter::write(const std::vector<int16_t>& data, int numFrames) {
         mWriter->write(data.data(), numFrames);
     }
+
+    std::vector<uint8_t> AudioWriter::writeHeader(int numChannels, int sampleRate, int fpsNum, int fpsDen, uint64_t dataSize) {
+        std::vector<uint8_t> header;
+
+        // Write a file without samples, then patch in the sizes the samples will have
+        {
+            AudioWriter writer(header, numChannels, sampleRate, fpsNum, fpsDen);
+        }
+
+        auto put32 = [&header](size_t offset, uint32_t value) {
+            for(size_t i = 0; i < sizeof(value); ++i)
+                header[offset + i] = static_cast<uint8_t>(value >> (8 * i));
+        };
+
+        auto put64 = [&header](size_t offset, uint64_t value) {
+            for(size_t i = 0; i < sizeof(value); ++i)
+                header[offset + i] = static_cast<uint8_t>(value >> (8 * i));
+        };
+
+        // The data chunk is the last chunk in the header and its size is its last field
+        const size_t dataSizeOffset = header.size() - sizeof(uint32_t);
+        const uint64_t riffSize = header.size() - 8 + dataSize;
+
+        if(riffSize <= UINT32_MAX) {
+            put32(4, static_cast<uint32_t>(riffSize));
+            put32(dataSizeOffset, static_cast<uint32_t>(dataSize));
+        }
+        else {
+            // Same as the writer does for files over 4GB, the JUNK chunk after the RIFF header becomes a ds64 chunk
+            std::memcpy(header.data(), "BW64", 4);
+            put32(4, INT32_MAX);
+            put32(dataSizeOffset, UINT32_MAX);
+
+            std::memcpy(header.data() + 12, "ds64", 4);
+            put64(20, riffSize);
+            put64(28, dataSize);
+            put64(36, 0);
+            put32(44, 0);
+        }
+
+        return header;
+    }
 }
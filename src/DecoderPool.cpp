@@ -0,0 +1,80 @@
+#include "DecoderPool.h"
+
+#include <motioncam/Decoder.hpp>
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+
+namespace motioncam {
+
+DecoderPool::Lease::Lease(std::shared_ptr<DecoderPool> pool, std::unique_ptr<Decoder> decoder) :
+    mPool(std::move(pool)),
+    mDecoder(std::move(decoder))
+{
+}
+
+DecoderPool::Lease::~Lease() {
+    if(mPool && mDecoder)
+        mPool->release(std::move(mDecoder));
+}
+
+std::shared_ptr<DecoderPool> DecoderPool::create(const std::string& path, size_t maxDecoders) {
+    return std::shared_ptr<DecoderPool>(new DecoderPool(path, maxDecoders));
+}
+
+DecoderPool::DecoderPool(const std::string& path, size_t maxDecoders) :
+    mPath(path),
+    mMaxDecoders((std::max)(maxDecoders, static_cast<size_t>(1))),
+    mOpen(0)
+{
+}
+
+DecoderPool::~DecoderPool() {
+    spdlog::debug("Closing {} decoders for {}", mIdle.size(), mPath);
+}
+
+DecoderPool::Lease DecoderPool::acquire() {
+    std::unique_lock<std::mutex> lock(mMutex);
+
+    mReleased.wait(lock, [this] { return !mIdle.empty() || mOpen < mMaxDecoders; });
+
+    if(!mIdle.empty()) {
+        auto decoder = std::move(mIdle.back());
+        mIdle.pop_back();
+
+        return Lease(shared_from_this(), std::move(decoder));
+    }
+
+    // Count the decoder before opening it so other threads don't go over the limit while the file is opened
+    ++mOpen;
+
+    lock.unlock();
+
+    try {
+        return Lease(shared_from_this(), std::make_unique<Decoder>(mPath));
+    }
+    catch(...) {
+        {
+            std::lock_guard<std::mutex> guard(mMutex);
+            --mOpen;
+        }
+
+        mReleased.notify_one();
+        throw;
+    }
+}
+
+const std::string& DecoderPool::path() const {
+    return mPath;
+}
+
+void DecoderPool::release(std::unique_ptr<Decoder> decoder) {
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mIdle.push_back(std::move(decoder));
+    }
+
+    mReleased.notify_one();
+}
+
+} // namespace motioncam
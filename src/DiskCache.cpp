@@ -0,0 +1,653 @@
+#include "DiskCache.h"
+
+#include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+
+#ifdef _WIN32
+    #include <windows.h>
+#else
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+namespace fs = boost::filesystem;
+
+namespace motioncam {
+
+namespace {
+    constexpr uint32_t DISK_CACHE_MAGIC = 0x4344434D; // "MCDC"
+    constexpr uint32_t DISK_CACHE_VERSION = 2;
+    constexpr auto ENTRY_EXTENSION = ".frame";
+    constexpr auto TEMP_EXTENSION = ".tmp";
+
+    // Frames read recently are kept mapped, reads go through a frame in many small pieces
+    constexpr size_t OPEN_FRAME_COUNT = 8;
+
+    constexpr uint64_t FNV_OFFSET = 0xCBF29CE484222325ull;
+    constexpr uint64_t FNV_PRIME = 0x100000001B3ull;
+
+    // Stored in front of every entry, followed by the size of each segment and then the segments, so torn writes
+    // and hash collisions are caught on read
+    struct FileHeader {
+        uint32_t magic;
+        uint32_t version;
+        uint64_t source;
+        uint64_t render;
+        int64_t frameIndex;
+        uint64_t numSegments;
+    };
+
+    // File names have to be the same on every run, so this doesn't use std::hash
+    uint64_t fnv1a(const void* data, size_t len, uint64_t hash) {
+        auto* bytes = static_cast<const uint8_t*>(data);
+
+        for(size_t i = 0; i < len; ++i) {
+            hash ^= bytes[i];
+            hash *= FNV_PRIME;
+        }
+
+        return hash;
+    }
+
+    template<typename T>
+    uint64_t hashValue(const T& value, uint64_t hash) {
+        return fnv1a(&value, sizeof(T), hash);
+    }
+
+    std::string toHex(uint64_t value) {
+        char hex[17];
+
+        std::snprintf(hex, sizeof(hex), "%016llx", static_cast<unsigned long long>(value));
+
+        return hex;
+    }
+
+    bool isHex(const std::string& name) {
+        return name.size() == 16 && name.find_first_not_of("0123456789abcdef") == std::string::npos;
+    }
+
+    // Entries are spread over 256 folders to keep directories small
+    fs::path getEntryPath(const std::string& folder, uint64_t hash) {
+        const auto name = toHex(hash);
+
+        return fs::path(folder) / name.substr(0, 2) / (name + ENTRY_EXTENSION);
+    }
+
+    bool parseEntryName(const fs::path& path, uint64_t& hash) {
+        if(path.extension() != ENTRY_EXTENSION)
+            return false;
+
+        const auto name = path.stem().string();
+
+        if(!isHex(name))
+            return false;
+
+        hash = std::stoull(name, nullptr, 16);
+
+        return true;
+    }
+
+    // Entries of the first version held one segment each and had no extension
+    bool isOldEntry(const fs::path& path) {
+        return !path.has_extension() && isHex(path.filename().string());
+    }
+
+    // The contents have to be on disk before the rename makes the entry visible, otherwise a crash can leave a
+    // complete looking entry with garbage in it
+    bool writeFileSync(const fs::path& path, const std::vector<std::pair<const char*, size_t>>& parts) {
+#ifdef _WIN32
+        HANDLE file = CreateFileW(
+            path.wstring().c_str(),
+            GENERIC_WRITE,
+            0,
+            nullptr,
+            CREATE_ALWAYS,
+            FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN,
+            nullptr);
+
+        if(file == INVALID_HANDLE_VALUE)
+            return false;
+
+        bool success = true;
+
+        for(const auto& [data, size] : parts) {
+            size_t written = 0;
+
+            while(success && written < size) {
+                const DWORD chunk = static_cast<DWORD>((std::min)(size - written, static_cast<size_t>(1) << 30));
+                DWORD chunkWritten = 0;
+
+                success = WriteFile(file, data + written, chunk, &chunkWritten, nullptr) && chunkWritten > 0;
+                written += chunkWritten;
+            }
+        }
+
+        success = success && FlushFileBuffers(file);
+
+        CloseHandle(file);
+
+        return success;
+#else
+        int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if(fd < 0)
+            return false;
+
+        bool success = true;
+
+        for(const auto& [data, size] : parts) {
+            size_t written = 0;
+
+            while(success && written < size) {
+                const ssize_t chunkWritten = write(fd, data + written, size - written);
+
+                if(chunkWritten < 0 && errno == EINTR)
+                    continue;
+
+                success = chunkWritten > 0;
+
+                if(success)
+                    written += static_cast<size_t>(chunkWritten);
+            }
+        }
+
+#ifdef __APPLE__
+        // fsync doesn't flush the drive cache on macOS
+        success = success && (fcntl(fd, F_FULLFSYNC) == 0 || fsync(fd) == 0);
+#else
+        success = success && fsync(fd) == 0;
+#endif
+
+        success = (close(fd) == 0) && success;
+
+        return success;
+#endif
+    }
+
+    // Read-only mapping of a whole file, empty if the file can't be mapped
+    class MappedFile {
+    public:
+        explicit MappedFile(const fs::path& path) : mData(nullptr), mSize(0) {
+#ifdef _WIN32
+            // Sharing delete lets eviction remove the file while it is mapped
+            HANDLE file = CreateFileW(
+                path.wstring().c_str(),
+                GENERIC_READ,
+                FILE_SHARE_READ | FILE_SHARE_DELETE,
+                nullptr,
+                OPEN_EXISTING,
+                FILE_FLAG_SEQUENTIAL_SCAN,
+                nullptr);
+
+            if(file == INVALID_HANDLE_VALUE)
+                return;
+
+            LARGE_INTEGER size;
+
+            if(GetFileSizeEx(file, &size) && size.QuadPart > 0) {
+                HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+
+                if(mapping) {
+                    mData = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+                    if(mData)
+                        mSize = static_cast<size_t>(size.QuadPart);
+
+                    CloseHandle(mapping);
+                }
+            }
+
+            CloseHandle(file);
+#else
+            int fd = open(path.c_str(), O_RDONLY);
+            if(fd < 0)
+                return;
+
+            struct stat st;
+
+            if(fstat(fd, &st) == 0 && st.st_size > 0) {
+                void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+                if(data != MAP_FAILED) {
+                    madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+                    mData = data;
+                    mSize = static_cast<size_t>(st.st_size);
+                }
+            }
+
+            // The mapping keeps the file open
+            close(fd);
+#endif
+        }
+
+        ~MappedFile() {
+            if(!mData)
+                return;
+
+#ifdef _WIN32
+            UnmapViewOfFile(mData);
+#else
+            munmap(mData, mSize);
+#endif
+        }
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        const char* data() const { return static_cast<const char*>(mData); }
+        size_t size() const { return mSize; }
+
+    private:
+        void* mData;
+        size_t mSize;
+    };
+}
+
+uint64_t DiskCacheKey::hash() const {
+    uint64_t hash = hashValue(source, FNV_OFFSET);
+
+    hash = hashValue(render, hash);
+
+    return hashValue(frameIndex, hash);
+}
+
+DiskCache::DiskCache(size_t maxSize) :
+    mMaxSize(maxSize),
+    mCurrentSize(0),
+    mScanId(0)
+{
+}
+
+DiskCache::~DiskCache() {
+    ++mScanId;
+
+    if(mScanThread.joinable())
+        mScanThread.join();
+}
+
+void DiskCache::setFolder(const std::string& path) {
+    const uint64_t scanId = ++mScanId;
+
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+
+        mFolder.clear();
+        mEntries.clear();
+        mIndex.clear();
+        mOpenFrames.clear();
+        mCurrentSize = 0;
+    }
+
+    // A scan that is still running sees the new id and stops at its next file
+    if(mScanThread.joinable())
+        mScanThread.join();
+
+    if(path.empty())
+        return;
+
+    // Large folders take a while to index, the caller may be the UI thread
+    mScanThread = std::thread(&DiskCache::scanFolder, this, path, scanId);
+}
+
+void DiskCache::scanFolder(const std::string& path, uint64_t scanId) {
+    boost::system::error_code ec;
+
+    fs::create_directories(path, ec);
+
+    if(ec) {
+        spdlog::error("Failed to create disk cache folder {} (error: {})", path, ec.message());
+        return;
+    }
+
+    // The folder is the index, so there is nothing to get out of sync when the app doesn't exit cleanly
+    std::vector<std::pair<std::time_t, Entry>> found;
+
+    for(fs::recursive_directory_iterator it(path, ec), end; !ec && it != end; it.increment(ec)) {
+        if(mScanId != scanId)
+            return;
+
+        boost::system::error_code fileEc;
+
+        if(!fs::is_regular_file(it->path(), fileEc))
+            continue;
+
+        // Left behind by writes that never finished, or by an older version
+        if(it->path().extension() == TEMP_EXTENSION || isOldEntry(it->path())) {
+            fs::remove(it->path(), fileEc);
+            continue;
+        }
+
+        uint64_t hash;
+        if(!parseEntryName(it->path(), hash))
+            continue;
+
+        const auto size = fs::file_size(it->path(), fileEc);
+        if(fileEc)
+            continue;
+
+        found.emplace_back(fs::last_write_time(it->path(), fileEc), Entry{ hash, static_cast<size_t>(size) });
+    }
+
+    // Most recently used first
+    std::stable_sort(found.begin(), found.end(), [](const auto& a, const auto& b) { return a.first > b.first; });
+
+    EntryList entries;
+    std::unordered_map<uint64_t, EntryList::iterator> index;
+    size_t currentSize = 0;
+
+    for(const auto& [time, entry] : found) {
+        if(index.count(entry.hash))
+            continue;
+
+        entries.push_back(entry);
+        index[entry.hash] = std::prev(entries.end());
+        currentSize += entry.size;
+    }
+
+    std::vector<std::string> evicted;
+    size_t numEntries = 0;
+
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+
+        if(mScanId != scanId)
+            return;
+
+        mFolder = path;
+        mEntries = std::move(entries);
+        mIndex = std::move(index);
+        mCurrentSize = currentSize;
+
+        // The budget applies to whatever was left from previous runs too
+        evicted = evict();
+
+        numEntries = mIndex.size();
+        currentSize = mCurrentSize;
+    }
+
+    for(const auto& file : evicted)
+        fs::remove(file, ec);
+
+    spdlog::info("Disk cache in {} ({} entries, {} MB)", path, numEntries, currentSize / (1024 * 1024));
+}
+
+bool DiskCache::enabled() const {
+    std::lock_guard<std::mutex> lock(mMutex);
+
+    return !mFolder.empty();
+}
+
+std::shared_ptr<const DiskCacheFrame> DiskCache::get(const DiskCacheKey& key) {
+    const uint64_t hash = key.hash();
+    std::string folder;
+
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+
+        auto it = mIndex.find(hash);
+        if(it == mIndex.end())
+            return nullptr;
+
+        mEntries.splice(mEntries.begin(), mEntries, it->second);
+
+        for(auto openIt = mOpenFrames.begin(); openIt != mOpenFrames.end(); ++openIt) {
+            if(openIt->first == hash) {
+                mOpenFrames.splice(mOpenFrames.begin(), mOpenFrames, openIt);
+                return openIt->second;
+            }
+        }
+
+        folder = mFolder;
+    }
+
+    const auto path = getEntryPath(folder, hash);
+    const auto file = std::make_shared<const MappedFile>(path);
+
+    FileHeader header{};
+
+    if(file->size() >= sizeof(header))
+        std::memcpy(&header, file->data(), sizeof(header));
+
+    bool valid =
+        file->size() >= sizeof(header) &&
+        header.magic == DISK_CACHE_MAGIC &&
+        header.version == DISK_CACHE_VERSION &&
+        header.source == key.source &&
+        header.render == key.render &&
+        header.frameIndex == key.frameIndex &&
+        header.numSegments <= (file->size() - sizeof(header)) / sizeof(uint64_t);
+
+    auto frame = std::make_shared<DiskCacheFrame>();
+
+    if(valid) {
+        size_t offset = sizeof(header) + header.numSegments * sizeof(uint64_t);
+
+        frame->mSegments.reserve(header.numSegments);
+
+        // The segments have to add up to the file exactly
+        for(uint64_t i = 0; valid && i < header.numSegments; ++i) {
+            uint64_t segmentSize;
+
+            std::memcpy(&segmentSize, file->data() + sizeof(header) + i * sizeof(uint64_t), sizeof(segmentSize));
+
+            valid = segmentSize <= file->size() - offset;
+
+            if(valid) {
+                frame->mSegments.emplace_back(file->data() + offset, static_cast<size_t>(segmentSize));
+                offset += static_cast<size_t>(segmentSize);
+            }
+        }
+
+        valid = valid && offset == file->size();
+    }
+
+    if(!valid) {
+        spdlog::warn("Dropping invalid disk cache entry {}", path.string());
+
+        remove(hash, folder);
+        return nullptr;
+    }
+
+    frame->mMapping = file;
+
+    // Recency survives restarts through the modification time
+    boost::system::error_code ec;
+
+    fs::last_write_time(path, std::time(nullptr), ec);
+
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+
+        if(mFolder == folder && mIndex.count(hash)) {
+            closeFrame(hash);
+
+            mOpenFrames.emplace_front(hash, frame);
+
+            if(mOpenFrames.size() > OPEN_FRAME_COUNT)
+                mOpenFrames.pop_back();
+        }
+    }
+
+    return frame;
+}
+
+void DiskCache::put(const DiskCacheKey& key, const std::vector<std::shared_ptr<std::vector<char>>>& segments) {
+    const uint64_t hash = key.hash();
+    std::string folder;
+
+    std::vector<uint64_t> segmentSizes;
+    size_t entrySize = sizeof(FileHeader) + segments.size() * sizeof(uint64_t);
+
+    segmentSizes.reserve(segments.size());
+
+    for(const auto& segment : segments) {
+        segmentSizes.push_back(segment->size());
+        entrySize += segment->size();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+
+        if(mFolder.empty() || entrySize > mMaxSize)
+            return;
+
+        folder = mFolder;
+    }
+
+    // Unique temporary name so concurrent writers of the same entry don't share a file
+    static std::atomic<uint64_t> tempId{0};
+
+    const auto path = getEntryPath(folder, hash);
+    const auto tempPath = fs::path(path.string() + "." + std::to_string(tempId++) + TEMP_EXTENSION);
+
+    boost::system::error_code ec;
+
+    fs::create_directories(path.parent_path(), ec);
+
+    const FileHeader header{
+        DISK_CACHE_MAGIC,
+        DISK_CACHE_VERSION,
+        key.source,
+        key.render,
+        key.frameIndex,
+        static_cast<uint64_t>(segments.size())
+    };
+
+    std::vector<std::pair<const char*, size_t>> parts;
+
+    parts.reserve(segments.size() + 2);
+    parts.emplace_back(reinterpret_cast<const char*>(&header), sizeof(header));
+    parts.emplace_back(reinterpret_cast<const char*>(segmentSizes.data()), segmentSizes.size() * sizeof(uint64_t));
+
+    for(const auto& segment : segments)
+        parts.emplace_back(segment->data(), segment->size());
+
+    if(!writeFileSync(tempPath, parts)) {
+        spdlog::warn("Failed to write disk cache entry {}", tempPath.string());
+
+        fs::remove(tempPath, ec);
+        return;
+    }
+
+    // Readers only ever see complete files
+    fs::rename(tempPath, path, ec);
+
+    if(ec) {
+        spdlog::warn("Failed to write disk cache entry {} (error: {})", path.string(), ec.message());
+
+        fs::remove(tempPath, ec);
+        return;
+    }
+
+    std::vector<std::string> evicted;
+
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+
+        // Folder changed while writing, the file belongs to the old one
+        if(mFolder != folder)
+            return;
+
+        auto it = mIndex.find(hash);
+
+        if(it != mIndex.end()) {
+            mCurrentSize -= it->second->size;
+
+            it->second->size = entrySize;
+            mEntries.splice(mEntries.begin(), mEntries, it->second);
+        }
+        else {
+            mEntries.push_front(Entry{ hash, entrySize });
+            mIndex[hash] = mEntries.begin();
+        }
+
+        mCurrentSize += entrySize;
+
+        closeFrame(hash);
+
+        evicted = evict();
+    }
+
+    for(const auto& file : evicted)
+        fs::remove(file, ec);
+}
+
+size_t DiskCache::size() const {
+    std::lock_guard<std::mutex> lock(mMutex);
+
+    return mCurrentSize;
+}
+
+size_t DiskCache::capacity() const {
+    return mMaxSize;
+}
+
+uint64_t DiskCache::getSourceId(const std::string& path) {
+    boost::system::error_code ec;
+
+    const auto absolutePath = fs::absolute(path).generic_string();
+    const auto size = fs::file_size(path, ec);
+    const auto modified = fs::last_write_time(path, ec);
+
+    uint64_t hash = fnv1a(absolutePath.data(), absolutePath.size(), FNV_OFFSET);
+
+    hash = hashValue(static_cast<uint64_t>(size), hash);
+
+    return hashValue(static_cast<int64_t>(modified), hash);
+}
+
+void DiskCache::remove(uint64_t hash, const std::string& folder) {
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+
+        if(mFolder != folder)
+            return;
+
+        auto it = mIndex.find(hash);
+        if(it != mIndex.end()) {
+            mCurrentSize -= it->second->size;
+            mEntries.erase(it->second);
+            mIndex.erase(it);
+        }
+
+        closeFrame(hash);
+    }
+
+    boost::system::error_code ec;
+
+    fs::remove(getEntryPath(folder, hash), ec);
+}
+
+std::vector<std::string> DiskCache::evict() {
+    std::vector<std::string> evicted;
+
+    while(!mEntries.empty() && mCurrentSize > mMaxSize) {
+        const auto& last = mEntries.back();
+
+        evicted.push_back(getEntryPath(mFolder, last.hash).string());
+
+        // Views that are still in use keep their mapping
+        closeFrame(last.hash);
+
+        mCurrentSize -= last.size;
+        mIndex.erase(last.hash);
+        mEntries.pop_back();
+    }
+
+    return evicted;
+}
+
+void DiskCache::closeFrame(uint64_t hash) {
+    mOpenFrames.remove_if([hash](const auto& openFrame) { return openFrame.first == hash; });
+}
+
+} // namespace motioncam
@@ -0,0 +1,289 @@
+#include "DngExporter.h"
+#include "VirtualFileSystemImpl_MCRAW.h"
+#include "CameraFrameMetadata.h"
+#include "CameraMetadata.h"
+#include "DecoderPool.h"
+#include "DiskCache.h"
+#include "LRUCache.h"
+#include "TaskScheduler.h"
+#include "Utils.h"
+
+#include <motioncam/Decoder.hpp>
+
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <vector>
+
+namespace fs = boost::filesystem;
+
+namespace motioncam {
+
+namespace {
+    constexpr auto IO_THREADS = 4;
+    constexpr auto WRITE_THREADS = 4;
+
+    // Decoded and rendered frames held at once, across all stages
+    constexpr uint64_t MEMORY_BUDGET = 2ull * 1024 * 1024 * 1024;
+    constexpr size_t MIN_FRAMES_IN_FLIGHT = 2;
+
+    // Only the audio is read through the file system
+    constexpr size_t AUDIO_CACHE_SIZE = 64 * 1024 * 1024;
+    constexpr size_t COPY_CHUNK_SIZE = 8 * 1024 * 1024;
+
+    // Dropped frames are filled with copies of the frame before, those are rendered once and written to every path
+    struct ExportFrame {
+        FrameReference frame;
+        std::vector<fs::path> paths;
+    };
+
+    fs::path getTempPath(const fs::path& path) {
+        auto tempPath = path;
+        tempPath += ".tmp";
+
+        return tempPath;
+    }
+
+    // Files are written under a temporary name and renamed, so an interrupted export never leaves a partial file
+    void writeFile(const fs::path& path, const std::vector<char>& data) {
+        const auto tempPath = getTempPath(path);
+
+        {
+            fs::ofstream file;
+
+            // Unbuffered, the whole file is handed to the OS in a single write
+            file.rdbuf()->pubsetbuf(nullptr, 0);
+            file.open(tempPath, std::ios::binary | std::ios::trunc);
+
+            if(!file.write(data.data(), static_cast<std::streamsize>(data.size())))
+                throw std::runtime_error("Failed to write " + tempPath.string());
+        }
+
+        fs::rename(tempPath, path);
+    }
+
+    void copyFile(VirtualFileSystemImpl_MCRAW& vfs, const Entry& entry, const fs::path& path) {
+        const auto tempPath = getTempPath(path);
+        std::vector<char> buffer(COPY_CHUNK_SIZE);
+
+        {
+            fs::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+
+            for(size_t pos = 0; pos < entry.size;) {
+                const size_t len = (std::min)(buffer.size(), entry.size - pos);
+                const int readBytes = vfs.readFile(entry, pos, len, buffer.data(), [](size_t, int) {}, false);
+
+                if(readBytes <= 0)
+                    throw std::runtime_error("Failed to read " + entry.name);
+
+                if(!file.write(buffer.data(), readBytes))
+                    throw std::runtime_error("Failed to write " + tempPath.string());
+
+                pos += static_cast<size_t>(readBytes);
+            }
+        }
+
+        fs::rename(tempPath, path);
+    }
+}
+
+DngExporter::DngExporter(const std::string& srcFile, const std::string& outputPath, FileRenderOptions options, int draftScale) :
+    mSrcFile(srcFile),
+    mOutputPath(outputPath),
+    mOptions(options),
+    mDraftScale(draftScale)
+{
+}
+
+ExportStats DngExporter::run(ProgressCallback onProgress) {
+    const auto startTime = std::chrono::steady_clock::now();
+
+    auto getElapsedSeconds = [startTime]() {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    };
+
+    // Decode, render and write each get their own threads so the stages overlap
+    TaskScheduler ioThreadPool("Export IO", IO_THREADS);
+    TaskScheduler processingThreadPool("Export");
+    TaskScheduler writeThreadPool("Export write", WRITE_THREADS);
+
+    LRUCache cache(AUDIO_CACHE_SIZE);
+    DiskCache diskCache(0);
+
+    // The mount decides the names and sizes of the files and fills in dropped frames, the export writes the same files
+    VirtualFileSystemImpl_MCRAW vfs(ioThreadPool, processingThreadPool, cache, diskCache, mOptions, mDraftScale, mSrcFile);
+
+    const auto fileInfo = vfs.getFileInfo();
+    const int scale = (mOptions & RENDER_OPT_DRAFT) ? mDraftScale : 1;
+
+    auto decoderPool = DecoderPool::create(mSrcFile, ioThreadPool.getThreadCount());
+    std::shared_ptr<const CameraConfiguration> cameraConfiguration;
+
+    {
+        auto decoder = decoderPool->acquire();
+
+        cameraConfiguration = std::make_shared<const CameraConfiguration>(
+            CameraConfiguration::parse(decoder->getContainerMetadata()));
+    }
+
+    std::vector<ExportFrame> frames;
+    std::vector<Entry> otherFiles;
+    size_t dngSize = 0;
+
+    fs::create_directories(mOutputPath);
+
+    for(const auto& entry : vfs.listFiles()) {
+        if(entry.type != FILE_ENTRY || boost::iequals(entry.name, "desktop.ini"))
+            continue;
+
+        const auto path = fs::path(mOutputPath) / entry.getFullPath();
+
+        if(!entry.pathParts.empty())
+            fs::create_directories(path.parent_path());
+
+        if(const auto* frame = std::get_if<FrameReference>(&entry.userData)) {
+            if(frames.empty() || frames.back().frame.frameIndex != frame->frameIndex)
+                frames.push_back(ExportFrame{ *frame, {} });
+
+            frames.back().paths.push_back(path);
+            dngSize = (std::max)(dngSize, entry.size);
+        }
+        else {
+            otherFiles.push_back(entry);
+        }
+    }
+
+    // A frame in flight holds its decoded pixels until it is rendered and its DNG until it is written
+    const uint64_t frameMemory = dngSize + static_cast<uint64_t>(fileInfo.width) * fileInfo.height * sizeof(uint16_t);
+    const size_t maxFramesInFlight = std::clamp(
+        static_cast<size_t>(MEMORY_BUDGET / (std::max)(frameMemory, static_cast<uint64_t>(1))),
+        MIN_FRAMES_IN_FLIGHT,
+        (std::max)(static_cast<size_t>(processingThreadPool.getThreadCount()) * 2, MIN_FRAMES_IN_FLIGHT));
+
+    spdlog::info("Exporting {} frames from {} to {} ({} frames in flight)",
+                 frames.size(), mSrcFile, mOutputPath, maxFramesInFlight);
+
+    std::mutex lock;
+    std::condition_variable frameDone;
+    size_t framesInFlight = 0;
+    std::exception_ptr error;
+    ExportStats stats{ 0, frames.size(), 0, 0, 0 };
+
+    auto finishFrame = [&](const ExportFrame* frame, size_t fileSize, std::exception_ptr frameError) {
+        std::lock_guard<std::mutex> guard(lock);
+
+        --framesInFlight;
+
+        if(frameError) {
+            if(!error)
+                error = frameError;
+        }
+        else {
+            ++stats.frames;
+            stats.files += frame->paths.size();
+            stats.bytes += static_cast<uint64_t>(fileSize) * frame->paths.size();
+            stats.seconds = getElapsedSeconds();
+
+            if(onProgress)
+                onProgress(stats);
+        }
+
+        frameDone.notify_all();
+    };
+
+    for(const auto& frame : frames) {
+        {
+            std::unique_lock<std::mutex> guard(lock);
+
+            frameDone.wait(guard, [&] { return framesInFlight < maxFramesInFlight || error; });
+
+            if(error)
+                break;
+
+            ++framesInFlight;
+        }
+
+        ioThreadPool.submit(TASK_PRIORITY_FOREGROUND, [&, frame = &frame]() {
+            try {
+                auto data = std::make_shared<std::vector<uint8_t>>();
+                nlohmann::json metadata;
+
+                decoderPool->acquire()->loadFrame(frame->frame.timestamp, *data, metadata);
+
+                auto frameMetadata = std::make_shared<const CameraFrameMetadata>(CameraFrameMetadata::parse(metadata));
+
+                processingThreadPool.submit(TASK_PRIORITY_FOREGROUND, [&, frame, data, frameMetadata]() mutable {
+                    try {
+                        auto dng = utils::generateDng(
+                            *data,
+                            *frameMetadata,
+                            *cameraConfiguration,
+                            fileInfo.fps,
+                            static_cast<int>(frame->frame.frameIndex),
+                            mOptions,
+                            scale);
+
+                        // Pixels are not needed while the DNG waits to be written
+                        data.reset();
+
+                        writeThreadPool.submit(TASK_PRIORITY_FOREGROUND, [&, frame, dng]() {
+                            try {
+                                for(const auto& path : frame->paths)
+                                    writeFile(path, *dng);
+
+                                finishFrame(frame, dng->size(), nullptr);
+                            }
+                            catch(...) {
+                                finishFrame(frame, 0, std::current_exception());
+                            }
+                        });
+                    }
+                    catch(...) {
+                        finishFrame(frame, 0, std::current_exception());
+                    }
+                });
+            }
+            catch(...) {
+                finishFrame(frame, 0, std::current_exception());
+            }
+        });
+    }
+
+    {
+        std::unique_lock<std::mutex> guard(lock);
+
+        frameDone.wait(guard, [&] { return framesInFlight == 0; });
+    }
+
+    // Tasks may still be returning after their last notification
+    ioThreadPool.wait();
+    processingThreadPool.wait();
+    writeThreadPool.wait();
+
+    if(error)
+        std::rethrow_exception(error);
+
+    for(const auto& entry : otherFiles) {
+        copyFile(vfs, entry, fs::path(mOutputPath) / entry.getFullPath());
+
+        ++stats.files;
+        stats.bytes += entry.size;
+    }
+
+    stats.seconds = getElapsedSeconds();
+
+    spdlog::info("Exported {} files ({} MB) in {:.1f} s, {:.1f} frames/s",
+                 stats.files, stats.bytes / (1024 * 1024), stats.seconds, stats.framesPerSecond());
+
+    return stats;
+}
+
+} // namespace motioncam
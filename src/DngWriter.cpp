@@ -0,0 +1,228 @@
+#include "DngWriter.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+namespace motioncam {
+
+namespace {
+    constexpr size_t DNG_HEADER_ALIGNMENT = 4096;
+    constexpr size_t TIFF_HEADER_SIZE = 8;
+    constexpr size_t IFD_ENTRY_SIZE = 12;
+
+    enum TiffType : uint16_t {
+        TIFF_BYTE       = 1,
+        TIFF_ASCII      = 2,
+        TIFF_SHORT      = 3,
+        TIFF_LONG       = 4,
+        TIFF_RATIONAL   = 5,
+        TIFF_SRATIONAL  = 10
+    };
+
+    inline void put16(uint8_t* dst, uint16_t v) {
+        dst[0] = v & 0xFF;
+        dst[1] = (v >> 8) & 0xFF;
+    }
+
+    inline void put32(uint8_t* dst, uint32_t v) {
+        dst[0] = v & 0xFF;
+        dst[1] = (v >> 8) & 0xFF;
+        dst[2] = (v >> 16) & 0xFF;
+        dst[3] = (v >> 24) & 0xFF;
+    }
+
+    inline size_t alignTo(size_t value, size_t alignment) {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+
+    // Uses the largest power of ten denominator that keeps the numerator in range
+    std::pair<int64_t, int64_t> toRational(float value, int64_t maxValue) {
+        if(!std::isfinite(value))
+            return { 0, 1 };
+
+        const double v = value;
+        int64_t denominator = 1;
+
+        while(denominator < 1000000000 && std::abs(v * denominator * 10) <= static_cast<double>(maxValue))
+            denominator *= 10;
+
+        return { std::llround(v * denominator), denominator };
+    }
+}
+
+DngWriter::DngWriter(uint32_t width, uint32_t height, uint16_t bitsPerSample) :
+    mWidth(width),
+    mHeight(height),
+    mBitsPerSample(bitsPerSample)
+{
+    setLong(DNG_TAG_NEW_SUBFILE_TYPE, 0);
+    setLong(DNG_TAG_IMAGE_WIDTH, width);
+    setLong(DNG_TAG_IMAGE_LENGTH, height);
+    setShort(DNG_TAG_BITS_PER_SAMPLE, bitsPerSample);
+    setShort(DNG_TAG_COMPRESSION, 1);
+    setShort(DNG_TAG_PHOTOMETRIC, 32803);
+    setShort(DNG_TAG_SAMPLES_PER_PIXEL, 1);
+    setShort(DNG_TAG_PLANAR_CONFIG, 1);
+
+    // Single strip, the offset is filled in by writeHeader()
+    setLong(DNG_TAG_STRIP_OFFSETS, 0);
+    setLong(DNG_TAG_ROWS_PER_STRIP, height);
+    setLong(DNG_TAG_STRIP_BYTE_COUNTS, static_cast<uint32_t>(imageSize()));
+}
+
+void DngWriter::setTag(DngTag tag, uint16_t type, uint32_t count, std::vector<uint8_t> data) {
+    mTags[tag] = Tag{ type, count, std::move(data) };
+}
+
+void DngWriter::setByte(DngTag tag, const uint8_t* values, uint32_t count) {
+    setTag(tag, TIFF_BYTE, count, std::vector<uint8_t>(values, values + count));
+}
+
+void DngWriter::setAscii(DngTag tag, const std::string& value) {
+    std::vector<uint8_t> data(value.begin(), value.end());
+    data.push_back(0);
+
+    const auto count = static_cast<uint32_t>(data.size());
+
+    setTag(tag, TIFF_ASCII, count, std::move(data));
+}
+
+void DngWriter::setShort(DngTag tag, const uint16_t* values, uint32_t count) {
+    std::vector<uint8_t> data(count * sizeof(uint16_t));
+
+    for(uint32_t i = 0; i < count; ++i)
+        put16(data.data() + i * sizeof(uint16_t), values[i]);
+
+    setTag(tag, TIFF_SHORT, count, std::move(data));
+}
+
+void DngWriter::setShort(DngTag tag, uint16_t value) {
+    setShort(tag, &value, 1);
+}
+
+void DngWriter::setLong(DngTag tag, const uint32_t* values, uint32_t count) {
+    std::vector<uint8_t> data(count * sizeof(uint32_t));
+
+    for(uint32_t i = 0; i < count; ++i)
+        put32(data.data() + i * sizeof(uint32_t), values[i]);
+
+    setTag(tag, TIFF_LONG, count, std::move(data));
+}
+
+void DngWriter::setLong(DngTag tag, uint32_t value) {
+    setLong(tag, &value, 1);
+}
+
+void DngWriter::setRational(DngTag tag, const float* values, uint32_t count) {
+    std::vector<uint8_t> data(count * 2 * sizeof(uint32_t));
+
+    for(uint32_t i = 0; i < count; ++i) {
+        auto [numerator, denominator] = toRational((std::max)(0.0f, values[i]), UINT32_MAX);
+
+        put32(data.data() + i * 8, static_cast<uint32_t>(numerator));
+        put32(data.data() + i * 8 + 4, static_cast<uint32_t>(denominator));
+    }
+
+    setTag(tag, TIFF_RATIONAL, count, std::move(data));
+}
+
+void DngWriter::setRational(DngTag tag, uint32_t numerator, uint32_t denominator) {
+    std::vector<uint8_t> data(2 * sizeof(uint32_t));
+
+    put32(data.data(), numerator);
+    put32(data.data() + 4, denominator);
+
+    setTag(tag, TIFF_RATIONAL, 1, std::move(data));
+}
+
+void DngWriter::setSRational(DngTag tag, const float* values, uint32_t count) {
+    std::vector<uint8_t> data(count * 2 * sizeof(int32_t));
+
+    for(uint32_t i = 0; i < count; ++i) {
+        auto [numerator, denominator] = toRational(values[i], INT32_MAX);
+
+        put32(data.data() + i * 8, static_cast<uint32_t>(static_cast<int32_t>(numerator)));
+        put32(data.data() + i * 8 + 4, static_cast<uint32_t>(static_cast<int32_t>(denominator)));
+    }
+
+    setTag(tag, TIFF_SRATIONAL, count, std::move(data));
+}
+
+void DngWriter::setSRational(DngTag tag, int32_t numerator, int32_t denominator) {
+    std::vector<uint8_t> data(2 * sizeof(int32_t));
+
+    put32(data.data(), static_cast<uint32_t>(numerator));
+    put32(data.data() + 4, static_cast<uint32_t>(denominator));
+
+    setTag(tag, TIFF_SRATIONAL, 1, std::move(data));
+}
+
+size_t DngWriter::headerSize() const {
+    size_t size = TIFF_HEADER_SIZE + sizeof(uint16_t) + mTags.size() * IFD_ENTRY_SIZE + sizeof(uint32_t);
+
+    // Values that don't fit in the entry are stored after the IFD, word aligned
+    for(const auto& [id, tag] : mTags) {
+        if(tag.data.size() > 4)
+            size += alignTo(tag.data.size(), 2);
+    }
+
+    return alignTo(size, DNG_HEADER_ALIGNMENT);
+}
+
+size_t DngWriter::imageSize() const {
+    return static_cast<size_t>(mWidth) * mHeight * mBitsPerSample / 8;
+}
+
+size_t DngWriter::fileSize() const {
+    return headerSize() + imageSize();
+}
+
+void DngWriter::writeHeader(uint8_t* dst) const {
+    const size_t size = headerSize();
+
+    if(size > UINT32_MAX)
+        throw std::runtime_error("DNG header too large");
+
+    std::memset(dst, 0, size);
+
+    // Little endian TIFF, first IFD follows the header
+    dst[0] = 'I';
+    dst[1] = 'I';
+    put16(dst + 2, 42);
+    put32(dst + 4, TIFF_HEADER_SIZE);
+
+    uint8_t* ifd = dst + TIFF_HEADER_SIZE;
+    size_t dataOffset = TIFF_HEADER_SIZE + sizeof(uint16_t) + mTags.size() * IFD_ENTRY_SIZE + sizeof(uint32_t);
+
+    put16(ifd, static_cast<uint16_t>(mTags.size()));
+    ifd += sizeof(uint16_t);
+
+    // Tags must be sorted, which std::map takes care of
+    for(const auto& [id, tag] : mTags) {
+        put16(ifd, id);
+        put16(ifd + 2, tag.type);
+        put32(ifd + 4, tag.count);
+
+        if(id == DNG_TAG_STRIP_OFFSETS) {
+            put32(ifd + 8, static_cast<uint32_t>(size));
+        }
+        else if(tag.data.size() <= 4) {
+            std::memcpy(ifd + 8, tag.data.data(), tag.data.size());
+        }
+        else {
+            put32(ifd + 8, static_cast<uint32_t>(dataOffset));
+            std::memcpy(dst + dataOffset, tag.data.data(), tag.data.size());
+
+            dataOffset += alignTo(tag.data.size(), 2);
+        }
+
+        ifd += IFD_ENTRY_SIZE;
+    }
+
+    // No more IFDs
+    put32(ifd, 0);
+}
+
+} // namespace motioncam
@@ -0,0 +1,533 @@
+#include "Kernels.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+    #define MOTIONCAM_KERNELS_X86 1
+    #include <immintrin.h>
+
+    #if defined(_MSC_VER) && !defined(__clang__)
+        #include <intrin.h>
+        #define TARGET_SSE41
+        #define TARGET_AVX2
+    #else
+        #define TARGET_SSE41 __attribute__((target("sse4.1")))
+        #define TARGET_AVX2 __attribute__((target("avx2")))
+    #endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+    #define MOTIONCAM_KERNELS_NEON 1
+    #include <arm_neon.h>
+#endif
+
+namespace motioncam {
+namespace kernels {
+
+namespace {
+
+using LinearizeRowFn = void (*)(const uint16_t*, const float*, uint16_t*, size_t, const LinearizeParams&);
+using PackRowFn = void (*)(const uint16_t*, uint8_t*, size_t, int);
+
+inline uint16_t linearizeSample(uint16_t s, float gain, int c, const LinearizeParams& p) {
+    const float v = std::max(0.0f, p.linear[c] * (s - p.srcBlackLevel[c]) * gain) * p.dstRange[c];
+
+    return static_cast<uint16_t>(std::clamp(std::round(v + p.dstBlackLevel[c]), 0.f, p.dstWhiteLevel));
+}
+
+void linearizeRow_Scalar(
+    const uint16_t* src, const float* gain, uint16_t* dst, size_t count, const LinearizeParams& p, size_t start)
+{
+    for(size_t i = start; i < count; ++i)
+        dst[i] = linearizeSample(src[i], gain ? gain[i] : 1.0f, static_cast<int>(i & 1), p);
+}
+
+void linearizeRow_Scalar(const uint16_t* src, const float* gain, uint16_t* dst, size_t count, const LinearizeParams& p) {
+    linearizeRow_Scalar(src, gain, dst, count, p, 0);
+}
+
+void packRow_Scalar(const uint16_t* src, uint8_t* dst, size_t count, int bits, size_t start) {
+    src += start;
+    dst += start * bits / 8;
+
+    switch(bits) {
+    case 10:
+        for(size_t x = start; x < count; x += 4) {
+            const uint16_t p0 = src[0];
+            const uint16_t p1 = src[1];
+            const uint16_t p2 = src[2];
+            const uint16_t p3 = src[3];
+
+            dst[0] = p0 >> 2;
+            dst[1] = ((p0 & 0x03) << 6) | (p1 >> 4);
+            dst[2] = ((p1 & 0x0F) << 4) | (p2 >> 6);
+            dst[3] = ((p2 & 0x3F) << 2) | (p3 >> 8);
+            dst[4] = p3 & 0xFF;
+
+            src += 4;
+            dst += 5;
+        }
+        break;
+
+    case 12:
+        for(size_t x = start; x < count; x += 2) {
+            const uint16_t p0 = src[0];
+            const uint16_t p1 = src[1];
+
+            dst[0] = p0 >> 4;
+            dst[1] = ((p0 & 0x0F) << 4) | (p1 >> 8);
+            dst[2] = p1 & 0xFF;
+
+            src += 2;
+            dst += 3;
+        }
+        break;
+
+    case 14:
+        for(size_t x = start; x < count; x += 4) {
+            const uint16_t p0 = src[0];
+            const uint16_t p1 = src[1];
+            const uint16_t p2 = src[2];
+            const uint16_t p3 = src[3];
+
+            dst[0] = p0 >> 6;
+            dst[1] = ((p0 & 0x3F) << 2) | (p1 >> 12);
+            dst[2] = (p1 >> 4) & 0xFF;
+            dst[3] = ((p1 & 0x0F) << 4) | (p2 >> 10);
+            dst[4] = (p2 >> 2) & 0xFF;
+            dst[5] = ((p2 & 0x03) << 6) | (p3 >> 8);
+            dst[6] = p3 & 0xFF;
+
+            src += 4;
+            dst += 7;
+        }
+        break;
+
+    default:
+        // 16 bit samples are stored as-is in little endian DNGs
+        std::memcpy(dst, src, (count - start) * sizeof(uint16_t));
+        break;
+    }
+}
+
+void packRow_Scalar(const uint16_t* src, uint8_t* dst, size_t count, int bits) {
+    packRow_Scalar(src, dst, count, bits, 0);
+}
+
+#if defined(MOTIONCAM_KERNELS_X86)
+
+bool cpuSupportsSse41() {
+#if defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuid(info, 1);
+
+    return (info[2] & (1 << 19)) != 0;
+#else
+    return __builtin_cpu_supports("sse4.1");
+#endif
+}
+
+bool cpuSupportsAvx2() {
+#if defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+
+    __cpuid(info, 0);
+    if(info[0] < 7)
+        return false;
+
+    // Check the OS saves the AVX registers
+    __cpuid(info, 1);
+
+    const bool osxsave = (info[2] & (1 << 27)) != 0;
+    const bool avx = (info[2] & (1 << 28)) != 0;
+
+    if(!osxsave || !avx || (_xgetbv(0) & 0x6) != 0x6)
+        return false;
+
+    __cpuidex(info, 7, 0);
+
+    return (info[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+// std::round() rounds halfway cases away from zero, which none of the SSE rounding modes do
+TARGET_SSE41 inline __m128 roundHalfAwayFromZero(__m128 v) {
+    const __m128 signMask = _mm_set1_ps(-0.0f);
+    const __m128 t = _mm_round_ps(v, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC);
+    const __m128 frac = _mm_andnot_ps(signMask, _mm_sub_ps(v, t));
+    const __m128 step = _mm_or_ps(_mm_set1_ps(1.0f), _mm_and_ps(v, signMask));
+
+    return _mm_add_ps(t, _mm_and_ps(_mm_cmpge_ps(frac, _mm_set1_ps(0.5f)), step));
+}
+
+TARGET_SSE41 inline __m128 linearize(__m128 s, __m128 gain, const __m128* p) {
+    const __m128 zero = _mm_setzero_ps();
+
+    // Same evaluation order as linearizeSample(), max(v, 0) returns 0 for NaN like std::max(0, v)
+    __m128 v = _mm_mul_ps(_mm_mul_ps(p[0], _mm_sub_ps(s, p[1])), gain);
+    v = _mm_mul_ps(_mm_max_ps(v, zero), p[3]);
+    v = roundHalfAwayFromZero(_mm_add_ps(v, p[2]));
+
+    return _mm_min_ps(_mm_max_ps(v, zero), p[4]);
+}
+
+TARGET_SSE41 void linearizeRow_SSE41(
+    const uint16_t* src, const float* gain, uint16_t* dst, size_t count, const LinearizeParams& p)
+{
+    const __m128 params[5] = {
+        _mm_setr_ps(p.linear[0], p.linear[1], p.linear[0], p.linear[1]),
+        _mm_setr_ps(p.srcBlackLevel[0], p.srcBlackLevel[1], p.srcBlackLevel[0], p.srcBlackLevel[1]),
+        _mm_setr_ps(p.dstBlackLevel[0], p.dstBlackLevel[1], p.dstBlackLevel[0], p.dstBlackLevel[1]),
+        _mm_setr_ps(p.dstRange[0], p.dstRange[1], p.dstRange[0], p.dstRange[1]),
+        _mm_set1_ps(p.dstWhiteLevel)
+    };
+
+    const __m128 one = _mm_set1_ps(1.0f);
+
+    size_t i = 0;
+
+    for(; i + 8 <= count; i += 8) {
+        const __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+
+        const __m128 s0 = _mm_cvtepi32_ps(_mm_cvtepu16_epi32(s));
+        const __m128 s1 = _mm_cvtepi32_ps(_mm_cvtepu16_epi32(_mm_srli_si128(s, 8)));
+
+        const __m128 g0 = gain ? _mm_loadu_ps(gain + i) : one;
+        const __m128 g1 = gain ? _mm_loadu_ps(gain + i + 4) : one;
+
+        const __m128i r0 = _mm_cvttps_epi32(linearize(s0, g0, params));
+        const __m128i r1 = _mm_cvttps_epi32(linearize(s1, g1, params));
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_packus_epi32(r0, r1));
+    }
+
+    linearizeRow_Scalar(src, gain, dst, count, p, i);
+}
+
+// Every 8 samples pack into Bits bytes. Pairs of samples are first merged into 32 bits with madd, for 10/14 bits
+// pairs of pairs are then merged into 64 bits, and pshufb gathers the big endian bytes of each lane.
+template<int Bits>
+TARGET_SSE41 inline __m128i packSamples(__m128i s) {
+    const __m128i pairMul = _mm_setr_epi16(1 << Bits, 1, 1 << Bits, 1, 1 << Bits, 1, 1 << Bits, 1);
+
+    __m128i v = _mm_madd_epi16(s, pairMul);
+
+    if constexpr (Bits == 12) {
+        const __m128i order = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+
+        return _mm_shuffle_epi8(v, order);
+    }
+    else if constexpr (Bits == 10) {
+        const __m128i order = _mm_setr_epi8(4, 3, 2, 1, 0, 12, 11, 10, 9, 8, -1, -1, -1, -1, -1, -1);
+
+        v = _mm_or_si128(_mm_slli_epi64(v, 2 * Bits), _mm_srli_epi64(v, 32));
+
+        return _mm_shuffle_epi8(v, order);
+    }
+    else {
+        const __m128i order = _mm_setr_epi8(6, 5, 4, 3, 2, 1, 0, 14, 13, 12, 11, 10, 9, 8, -1, -1);
+
+        v = _mm_or_si128(_mm_slli_epi64(v, 2 * Bits), _mm_srli_epi64(v, 32));
+
+        return _mm_shuffle_epi8(v, order);
+    }
+}
+
+// Each store writes a full 16 bytes, so stop while the tail of the row is still ahead of it
+template<int Bits>
+TARGET_SSE41 size_t packRow_SSE41(const uint16_t* src, uint8_t* dst, size_t count, size_t start) {
+    size_t i = start;
+
+    for(; i + 16 <= count; i += 8) {
+        const __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * Bits / 8), packSamples<Bits>(s));
+    }
+
+    return i;
+}
+
+TARGET_SSE41 void packRow_SSE41(const uint16_t* src, uint8_t* dst, size_t count, int bits) {
+    size_t i = 0;
+
+    switch(bits) {
+    case 10: i = packRow_SSE41<10>(src, dst, count, 0); break;
+    case 12: i = packRow_SSE41<12>(src, dst, count, 0); break;
+    case 14: i = packRow_SSE41<14>(src, dst, count, 0); break;
+    }
+
+    packRow_Scalar(src, dst, count, bits, i);
+}
+
+TARGET_AVX2 inline __m256 roundHalfAwayFromZero(__m256 v) {
+    const __m256 signMask = _mm256_set1_ps(-0.0f);
+    const __m256 t = _mm256_round_ps(v, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC);
+    const __m256 frac = _mm256_andnot_ps(signMask, _mm256_sub_ps(v, t));
+    const __m256 step = _mm256_or_ps(_mm256_set1_ps(1.0f), _mm256_and_ps(v, signMask));
+
+    return _mm256_add_ps(t, _mm256_and_ps(_mm256_cmp_ps(frac, _mm256_set1_ps(0.5f), _CMP_GE_OQ), step));
+}
+
+TARGET_AVX2 inline __m256 linearize(__m256 s, __m256 gain, const __m256* p) {
+    const __m256 zero = _mm256_setzero_ps();
+
+    __m256 v = _mm256_mul_ps(_mm256_mul_ps(p[0], _mm256_sub_ps(s, p[1])), gain);
+    v = _mm256_mul_ps(_mm256_max_ps(v, zero), p[3]);
+    v = roundHalfAwayFromZero(_mm256_add_ps(v, p[2]));
+
+    return _mm256_min_ps(_mm256_max_ps(v, zero), p[4]);
+}
+
+TARGET_AVX2 void linearizeRow_AVX2(
+    const uint16_t* src, const float* gain, uint16_t* dst, size_t count, const LinearizeParams& p)
+{
+    const __m256 params[5] = {
+        _mm256_setr_ps(p.linear[0], p.linear[1], p.linear[0], p.linear[1], p.linear[0], p.linear[1], p.linear[0], p.linear[1]),
+        _mm256_setr_ps(p.srcBlackLevel[0], p.srcBlackLevel[1], p.srcBlackLevel[0], p.srcBlackLevel[1],
+                       p.srcBlackLevel[0], p.srcBlackLevel[1], p.srcBlackLevel[0], p.srcBlackLevel[1]),
+        _mm256_setr_ps(p.dstBlackLevel[0], p.dstBlackLevel[1], p.dstBlackLevel[0], p.dstBlackLevel[1],
+                       p.dstBlackLevel[0], p.dstBlackLevel[1], p.dstBlackLevel[0], p.dstBlackLevel[1]),
+        _mm256_setr_ps(p.dstRange[0], p.dstRange[1], p.dstRange[0], p.dstRange[1],
+                       p.dstRange[0], p.dstRange[1], p.dstRange[0], p.dstRange[1]),
+        _mm256_set1_ps(p.dstWhiteLevel)
+    };
+
+    const __m256 one = _mm256_set1_ps(1.0f);
+
+    size_t i = 0;
+
+    for(; i + 16 <= count; i += 16) {
+        const __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+
+        const __m256 s0 = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm256_castsi256_si128(s)));
+        const __m256 s1 = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm256_extracti128_si256(s, 1)));
+
+        const __m256 g0 = gain ? _mm256_loadu_ps(gain + i) : one;
+        const __m256 g1 = gain ? _mm256_loadu_ps(gain + i + 8) : one;
+
+        const __m256i r0 = _mm256_cvttps_epi32(linearize(s0, g0, params));
+        const __m256i r1 = _mm256_cvttps_epi32(linearize(s1, g1, params));
+
+        // packus works within 128-bit lanes, restore the order afterwards
+        const __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi32(r0, r1), _MM_SHUFFLE(3, 1, 2, 0));
+
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), packed);
+    }
+
+    linearizeRow_Scalar(src, gain, dst, count, p, i);
+}
+
+template<int Bits>
+TARGET_AVX2 inline __m256i packSamples(__m256i s) {
+    const __m256i pairMul = _mm256_set1_epi32((1 << Bits) | (1 << 16));
+
+    __m256i v = _mm256_madd_epi16(s, pairMul);
+
+    if constexpr (Bits == 12) {
+        const __m256i order = _mm256_setr_epi8(
+            2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+            2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+
+        return _mm256_shuffle_epi8(v, order);
+    }
+    else if constexpr (Bits == 10) {
+        const __m256i order = _mm256_setr_epi8(
+            4, 3, 2, 1, 0, 12, 11, 10, 9, 8, -1, -1, -1, -1, -1, -1,
+            4, 3, 2, 1, 0, 12, 11, 10, 9, 8, -1, -1, -1, -1, -1, -1);
+
+        v = _mm256_or_si256(_mm256_slli_epi64(v, 2 * Bits), _mm256_srli_epi64(v, 32));
+
+        return _mm256_shuffle_epi8(v, order);
+    }
+    else {
+        const __m256i order = _mm256_setr_epi8(
+            6, 5, 4, 3, 2, 1, 0, 14, 13, 12, 11, 10, 9, 8, -1, -1,
+            6, 5, 4, 3, 2, 1, 0, 14, 13, 12, 11, 10, 9, 8, -1, -1);
+
+        v = _mm256_or_si256(_mm256_slli_epi64(v, 2 * Bits), _mm256_srli_epi64(v, 32));
+
+        return _mm256_shuffle_epi8(v, order);
+    }
+}
+
+// shuffle_epi8 works within 128-bit lanes, each lane is stored separately
+template<int Bits>
+TARGET_AVX2 size_t packRow_AVX2(const uint16_t* src, uint8_t* dst, size_t count) {
+    size_t i = 0;
+
+    for(; i + 32 <= count; i += 16) {
+        const __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        const __m256i v = packSamples<Bits>(s);
+
+        uint8_t* out = dst + i * Bits / 8;
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm256_castsi256_si128(v));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + Bits), _mm256_extracti128_si256(v, 1));
+    }
+
+    return packRow_SSE41<Bits>(src, dst, count, i);
+}
+
+TARGET_AVX2 void packRow_AVX2(const uint16_t* src, uint8_t* dst, size_t count, int bits) {
+    size_t i = 0;
+
+    switch(bits) {
+    case 10: i = packRow_AVX2<10>(src, dst, count); break;
+    case 12: i = packRow_AVX2<12>(src, dst, count); break;
+    case 14: i = packRow_AVX2<14>(src, dst, count); break;
+    }
+
+    packRow_Scalar(src, dst, count, bits, i);
+}
+
+#elif defined(MOTIONCAM_KERNELS_NEON)
+
+inline float32x4_t linearize(float32x4_t s, float32x4_t gain, const float32x4_t* p) {
+    const float32x4_t zero = vdupq_n_f32(0.0f);
+
+    // vmaxq_f32() propagates NaN, select explicitly to match std::max(0, v)
+    float32x4_t v = vmulq_f32(vmulq_f32(p[0], vsubq_f32(s, p[1])), gain);
+    v = vmulq_f32(vbslq_f32(vcltq_f32(zero, v), v, zero), p[3]);
+
+    // vrndaq_f32() rounds halfway cases away from zero like std::round()
+    v = vrndaq_f32(vaddq_f32(v, p[2]));
+
+    return vminq_f32(vmaxq_f32(v, zero), p[4]);
+}
+
+void linearizeRow_NEON(
+    const uint16_t* src, const float* gain, uint16_t* dst, size_t count, const LinearizeParams& p)
+{
+    const float linear[4] = { p.linear[0], p.linear[1], p.linear[0], p.linear[1] };
+    const float srcBlackLevel[4] = { p.srcBlackLevel[0], p.srcBlackLevel[1], p.srcBlackLevel[0], p.srcBlackLevel[1] };
+    const float dstBlackLevel[4] = { p.dstBlackLevel[0], p.dstBlackLevel[1], p.dstBlackLevel[0], p.dstBlackLevel[1] };
+    const float dstRange[4] = { p.dstRange[0], p.dstRange[1], p.dstRange[0], p.dstRange[1] };
+
+    const float32x4_t params[5] = {
+        vld1q_f32(linear),
+        vld1q_f32(srcBlackLevel),
+        vld1q_f32(dstBlackLevel),
+        vld1q_f32(dstRange),
+        vdupq_n_f32(p.dstWhiteLevel)
+    };
+
+    const float32x4_t one = vdupq_n_f32(1.0f);
+
+    size_t i = 0;
+
+    for(; i + 8 <= count; i += 8) {
+        const uint16x8_t s = vld1q_u16(src + i);
+
+        const float32x4_t s0 = vcvtq_f32_u32(vmovl_u16(vget_low_u16(s)));
+        const float32x4_t s1 = vcvtq_f32_u32(vmovl_u16(vget_high_u16(s)));
+
+        const float32x4_t g0 = gain ? vld1q_f32(gain + i) : one;
+        const float32x4_t g1 = gain ? vld1q_f32(gain + i + 4) : one;
+
+        const uint32x4_t r0 = vcvtq_u32_f32(linearize(s0, g0, params));
+        const uint32x4_t r1 = vcvtq_u32_f32(linearize(s1, g1, params));
+
+        vst1q_u16(dst + i, vcombine_u16(vmovn_u32(r0), vmovn_u32(r1)));
+    }
+
+    linearizeRow_Scalar(src, gain, dst, count, p, i);
+}
+
+// Same scheme as the x86 packers, with shifts in place of madd and tbl in place of pshufb
+template<int Bits>
+size_t packRow_NEON(const uint16_t* src, uint8_t* dst, size_t count) {
+    static const uint8_t order10[16] = { 4, 3, 2, 1, 0, 12, 11, 10, 9, 8, 255, 255, 255, 255, 255, 255 };
+    static const uint8_t order12[16] = { 2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, 255, 255, 255, 255 };
+    static const uint8_t order14[16] = { 6, 5, 4, 3, 2, 1, 0, 14, 13, 12, 11, 10, 9, 8, 255, 255 };
+
+    const uint8x16_t order = vld1q_u8(Bits == 10 ? order10 : (Bits == 12 ? order12 : order14));
+    const uint32x4_t lowMask = vdupq_n_u32(0xFFFF);
+
+    size_t i = 0;
+
+    for(; i + 16 <= count; i += 8) {
+        const uint32x4_t s = vreinterpretq_u32_u16(vld1q_u16(src + i));
+
+        uint32x4_t v = vorrq_u32(vshlq_n_u32(vandq_u32(s, lowMask), Bits), vshrq_n_u32(s, 16));
+
+        if constexpr (Bits != 12) {
+            const uint64x2_t w = vreinterpretq_u64_u32(v);
+
+            v = vreinterpretq_u32_u64(vorrq_u64(vshlq_n_u64(w, 2 * Bits), vshrq_n_u64(w, 32)));
+        }
+
+        vst1q_u8(dst + i * Bits / 8, vqtbl1q_u8(vreinterpretq_u8_u32(v), order));
+    }
+
+    return i;
+}
+
+void packRow_NEON(const uint16_t* src, uint8_t* dst, size_t count, int bits) {
+    size_t i = 0;
+
+    switch(bits) {
+    case 10: i = packRow_NEON<10>(src, dst, count); break;
+    case 12: i = packRow_NEON<12>(src, dst, count); break;
+    case 14: i = packRow_NEON<14>(src, dst, count); break;
+    }
+
+    packRow_Scalar(src, dst, count, bits, i);
+}
+
+#endif
+
+struct Dispatch {
+    LinearizeRowFn linearizeRow;
+    PackRowFn packRow;
+    const char* name;
+};
+
+Dispatch selectKernels() {
+#if defined(MOTIONCAM_KERNELS_X86)
+    if(cpuSupportsAvx2())
+        return { linearizeRow_AVX2, packRow_AVX2, "AVX2" };
+
+    if(cpuSupportsSse41())
+        return { linearizeRow_SSE41, packRow_SSE41, "SSE4.1" };
+#elif defined(MOTIONCAM_KERNELS_NEON)
+    return { linearizeRow_NEON, packRow_NEON, "NEON" };
+#endif
+
+    return { linearizeRow_Scalar, packRow_Scalar, "Scalar" };
+}
+
+const Dispatch& getDispatch() {
+    static const Dispatch dispatch = selectKernels();
+
+    return dispatch;
+}
+
+} // namespace
+
+void linearizeRow(
+    const uint16_t* src,
+    const float* gain,
+    uint16_t* dst,
+    size_t count,
+    const LinearizeParams& params)
+{
+    getDispatch().linearizeRow(src, gain, dst, count, params);
+}
+
+void packRow(
+    const uint16_t* src,
+    uint8_t* dst,
+    size_t count,
+    int bits)
+{
+    getDispatch().packRow(src, dst, count, bits);
+}
+
+const char* activeInstructionSet() {
+    return getDispatch().name;
+}
+
+} // namespace kernels
+} // namespace motioncam
@@ -0,0 +1,169 @@
+#include "TaskScheduler.h"
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+
+namespace motioncam {
+
+namespace {
+    // Weight of the newest sample in the average wait time
+    constexpr double WAIT_TIME_SMOOTHING = 0.1;
+
+    const char* getPriorityName(int priority) {
+        switch(priority) {
+            case TASK_PRIORITY_FOREGROUND:
+                return "foreground";
+            case TASK_PRIORITY_PREFETCH:
+                return "prefetch";
+            default:
+                return "unknown";
+        }
+    }
+}
+
+TaskScheduler::TaskScheduler(const std::string& name, unsigned int numThreads) :
+    mName(name),
+    mStopping(false)
+{
+    if(numThreads == 0)
+        numThreads = (std::max)(std::thread::hardware_concurrency(), 1u);
+
+    mThreads.reserve(numThreads);
+
+    for(unsigned int i = 0; i < numThreads; ++i)
+        mThreads.emplace_back(&TaskScheduler::workerMain, this);
+}
+
+TaskScheduler::~TaskScheduler() {
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mStopping = true;
+    }
+
+    // Workers finish what is queued before they exit
+    mTaskAvailable.notify_all();
+
+    for(auto& thread : mThreads)
+        thread.join();
+
+    for(int i = 0; i < TASK_PRIORITY_COUNT; ++i) {
+        const auto& stats = mQueues[i].stats;
+
+        spdlog::info("{} {} tasks: {} completed, {} cancelled, {:.1f} ms average wait",
+                     mName, getPriorityName(i), stats.completed, stats.cancelled, stats.averageWaitMs);
+    }
+}
+
+void TaskScheduler::submit(
+    TaskPriority priority,
+    std::function<void()> task,
+    std::function<bool()> isCancelled,
+    std::function<void()> onCancel)
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+
+        auto& queue = mQueues[priority];
+
+        queue.tasks.push_back(Task{
+            std::move(task), std::move(isCancelled), std::move(onCancel), std::chrono::steady_clock::now() });
+
+        queue.stats.queued = queue.tasks.size();
+    }
+
+    mTaskAvailable.notify_one();
+}
+
+void TaskScheduler::wait() {
+    std::unique_lock<std::mutex> lock(mMutex);
+
+    mIdle.wait(lock, [this] { return isIdle(); });
+}
+
+unsigned int TaskScheduler::getThreadCount() const {
+    return static_cast<unsigned int>(mThreads.size());
+}
+
+TaskQueueStats TaskScheduler::getStats(TaskPriority priority) const {
+    std::lock_guard<std::mutex> lock(mMutex);
+
+    return mQueues[priority].stats;
+}
+
+// Must be called with the lock held
+bool TaskScheduler::isIdle() const {
+    return std::all_of(mQueues.begin(), mQueues.end(), [](const Queue& queue) {
+        return queue.tasks.empty() && queue.stats.running == 0;
+    });
+}
+
+void TaskScheduler::workerMain() {
+    while(true) {
+        Task task;
+        Queue* queue = nullptr;
+
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+
+            mTaskAvailable.wait(lock, [this] {
+                return mStopping || std::any_of(mQueues.begin(), mQueues.end(), [](const Queue& q) { return !q.tasks.empty(); });
+            });
+
+            auto it = std::find_if(mQueues.begin(), mQueues.end(), [](const Queue& q) { return !q.tasks.empty(); });
+            if(it == mQueues.end())
+                return; // Stopping and nothing left to run
+
+            queue = &*it;
+
+            // Oldest first, reads that were abandoned are cancelled by their callers instead of starved
+            task = std::move(queue->tasks.front());
+            queue->tasks.pop_front();
+
+            const double waitMs =
+                std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - task.queuedTime).count();
+
+            auto& stats = queue->stats;
+
+            stats.averageWaitMs = stats.completed + stats.cancelled > 0 ?
+                stats.averageWaitMs + (waitMs - stats.averageWaitMs) * WAIT_TIME_SMOOTHING : waitMs;
+
+            stats.queued = queue->tasks.size();
+            ++stats.running;
+        }
+
+        const bool cancelled = task.isCancelled && task.isCancelled();
+
+        try {
+            if(!cancelled)
+                task.run();
+            else if(task.onCancel)
+                task.onCancel();
+        }
+        catch(std::exception& e) {
+            spdlog::error("{} task failed (error: {})", mName, e.what());
+        }
+        catch(...) {
+            spdlog::error("{} task failed", mName);
+        }
+
+        // Release whatever the task captured before reporting it as done
+        task = Task();
+
+        std::lock_guard<std::mutex> lock(mMutex);
+
+        auto& stats = queue->stats;
+
+        --stats.running;
+
+        if(cancelled)
+            ++stats.cancelled;
+        else
+            ++stats.completed;
+
+        if(isIdle())
+            mIdle.notify_all();
+    }
+}
+
+} // namespace motioncam
@@ -1,23 +1,24 @@
 #include "Utils.h"
 #include "Measure.h"
+#include "Kernels.h"
+#include "DngWriter.h"
 
 #include "CameraFrameMetadata.h"
 #include "CameraMetadata.h"
 
 #include <algorithm>
 #include <cmath>
-
-#include <boost/iostreams/stream.hpp>
-#include <boost/iostreams/device/back_inserter.hpp>
-
-#define TINY_DNG_WRITER_IMPLEMENTATION 1
-
-#include <tinydng/tiny_dng_writer.h>
+#include <cstring>
+#include <list>
+#include <mutex>
 
 namespace motioncam {
 namespace utils {
 
 namespace {
+    // Tables are a few hundred KB, one per shading map and geometry
+    constexpr auto SHADING_GAIN_CACHE_SIZE = 8;
+
     const float IDENTITY_MATRIX[9] = {
         1.0f, 0.0f, 0.0f,
         0.0f, 1.0f, 0.0f,
@@ -127,152 +128,196 @@ namespace {
         }
     }
 
-    inline float getShadingMapValue(
-        float x, float y, int channel, const std::vector<std::vector<float>>& lensShadingMap, int lensShadingMapWidth, int lensShadingMapHeight)
-    {
-        // Clamp input coordinates to [0, 1] range
-        x = std::max(0.0f, std::min(1.0f, x));
-        y = std::max(0.0f, std::min(1.0f, y));
-
-        // Convert normalized coordinates to map coordinates
-        const float mapX = x * (lensShadingMapWidth - 1);
-        const float mapY = y * (lensShadingMapHeight - 1);
-
-        // Get integer coordinates for the four surrounding pixels
-        const int x0 = static_cast<int>(std::floor(mapX));
-        const int y0 = static_cast<int>(std::floor(mapY));
-        const int x1 = std::min(x0 + 1, lensShadingMapWidth - 1);
-        const int y1 = std::min(y0 + 1, lensShadingMapHeight - 1);
-
-        // Calculate interpolation weights
-        const float wx = mapX - x0;  // Weight for x-direction interpolation
-        const float wy = mapY - y0;  // Weight for y-direction interpolation
-
-        // Get the four surrounding pixel values
-        const float val00 = lensShadingMap[channel][y0*lensShadingMapWidth+x0];  // Top-left
-        const float val01 = lensShadingMap[channel][y0*lensShadingMapWidth+x1];  // Top-right
-        const float val10 = lensShadingMap[channel][y1*lensShadingMapWidth+x0];  // Bottom-left
-        const float val11 = lensShadingMap[channel][y1*lensShadingMapWidth+x1];  // Bottom-right
-
-        // Perform bilinear interpolation
-        const float valTop = val00 * (1.0f - wx) + val01 * wx;     // Interpolation at y0
-        const float valBottom = val10 * (1.0f - wx) + val11 * wx;  // Interpolation at y1
-
-        // Then interpolate along y-axis
-        return valTop * (1.0f - wy) + valBottom * wy;
-    }
-}
-
-void encodeTo10Bit(
-    std::vector<uint8_t>& data,
-    uint32_t& width,
-    uint32_t& height)
-{
-    Measure m("encodeTo10Bit");
-
-    uint16_t* srcPtr = reinterpret_cast<uint16_t*>(data.data());
-    uint8_t* dstPtr = data.data();
-
-    for(int y = 0; y < height; y++) {
-        for(int x = 0; x < width; x+=4) {
-            const uint16_t p0 = srcPtr[0];
-            const uint16_t p1 = srcPtr[1];
-            const uint16_t p2 = srcPtr[2];
-            const uint16_t p3 = srcPtr[3];
-
-            dstPtr[0] = p0 >> 2;
-            dstPtr[1] = ((p0 & 0x03) << 6) | (p1 >> 4);
-            dstPtr[2] = ((p1 & 0x0F) << 4) | (p2 >> 6);
-            dstPtr[3] = ((p2 & 0x3F) << 2) | (p3 >> 8);
-            dstPtr[4] = p3 & 0xFF;
-
-            srcPtr += 4;
-            dstPtr += 5;
+    // Shading gains for one output geometry. The shading map is bilinearly interpolated, so each map row is
+    // interpolated across the output columns once, resolved to the CFA channel of every column, and gains for an
+    // output row are blended from the two map rows around it when the row is rendered. Keeps the table at the
+    // height of the shading map instead of the frame and gives the same values as interpolating every pixel.
+    struct ShadingGainTable {
+        std::vector<std::vector<float>> lensShadingMap;
+        int lensShadingMapWidth;
+        int lensShadingMapHeight;
+        bool normalised;
+        uint32_t scale;
+        int left;
+        int top;
+        int fullWidth;
+        int fullHeight;
+        uint32_t width;
+        uint32_t height;
+        std::array<uint8_t, 4> cfa;
+
+        // Built by the first thread that needs the table, others wait for it
+        std::once_flag built;
+
+        // Map rows interpolated across the output columns, [map row][even/odd output row][column]
+        std::vector<float> mapRows;
+
+        bool matches(
+            const CameraFrameMetadata& metadata,
+            bool normaliseShadingMap,
+            uint32_t scale_,
+            int left_,
+            int top_,
+            uint32_t width_,
+            uint32_t height_,
+            const std::array<uint8_t, 4>& cfa_) const
+        {
+            return
+                normalised == normaliseShadingMap &&
+                scale == scale_ &&
+                left == left_ &&
+                top == top_ &&
+                fullWidth == metadata.originalWidth &&
+                fullHeight == metadata.originalHeight &&
+                width == width_ &&
+                height == height_ &&
+                cfa == cfa_ &&
+                lensShadingMapWidth == metadata.lensShadingMapWidth &&
+                lensShadingMapHeight == metadata.lensShadingMapHeight &&
+                lensShadingMap == metadata.lensShadingMap;
         }
-    }
 
-    // Resize to fit new data
-    auto newSize = dstPtr - data.data();
+        void build() {
+            Measure m("buildShadingGainTable");
 
-    data.resize(newSize);
-}
+            auto map = lensShadingMap;
 
-void encodeTo12Bit(
-    std::vector<uint8_t>& data,
-    uint32_t& width,
-    uint32_t& height)
-{
-    Measure m("encodeTo12Bit");
+            if(normalised)
+                normalizeShadingMap(map);
 
-    uint16_t* srcPtr = reinterpret_cast<uint16_t*>(data.data());
-    uint8_t* dstPtr = data.data();
+            const float shadingMapScaleX = 1.0f / static_cast<float>(fullWidth);
 
-    for(int y = 0; y < height; y++) {
-        for(int x = 0; x < width; x+=2) {
-            const uint16_t p0 = srcPtr[0];
-            const uint16_t p1 = srcPtr[1];
+            mapRows.resize(static_cast<size_t>(lensShadingMapHeight) * 2 * width);
 
-            dstPtr[0] = p0 >> 4;
-            dstPtr[1] = ((p0 & 0x0F) << 4) | (p1 >> 8);
-            dstPtr[2] = p1 & 0xFF;
+            for(uint32_t x = 0; x < width; x += 2) {
+                // Position in the shading map of the 2x2 block
+                const float sx = std::max(0.0f, std::min(1.0f, (x * scale + left) * shadingMapScaleX));
+                const float mapX = sx * (lensShadingMapWidth - 1);
 
-            srcPtr += 2;
-            dstPtr += 3;
+                const int x0 = static_cast<int>(std::floor(mapX));
+                const int x1 = std::min(x0 + 1, lensShadingMapWidth - 1);
+                const float wx = mapX - x0;
+
+                for(int mapY = 0; mapY < lensShadingMapHeight; ++mapY) {
+                    for(int row = 0; row < 2; ++row) {
+                        float* dst = mapRows.data() + (static_cast<size_t>(mapY) * 2 + row) * width + x;
+
+                        for(int col = 0; col < 2; ++col) {
+                            const auto& channel = map[cfa[row * 2 + col]];
+
+                            dst[col] = channel[mapY * lensShadingMapWidth + x0] * (1.0f - wx) +
+                                       channel[mapY * lensShadingMapWidth + x1] * wx;
+                        }
+                    }
+                }
+            }
         }
-    }
-    // Resize to fit new data
-    auto newSize = dstPtr - data.data();
 
-    data.resize(newSize);
-}
+        // Gains of output row y, width values
+        void getRow(uint32_t y, float* dst) const {
+            const float shadingMapScaleY = 1.0f / static_cast<float>(fullHeight);
 
-void encodeTo14Bit(
-    std::vector<uint8_t>& data,
-    uint32_t& width,
-    uint32_t& height)
-{
-    Measure m("encodeTo14Bit");
-
-    uint16_t* srcPtr = reinterpret_cast<uint16_t*>(data.data());
-    uint8_t* dstPtr = data.data();
-
-    for(int y = 0; y < height; y++) {
-        for(int x = 0; x < width; x+=4) {
-            const uint16_t p0 = srcPtr[0];
-            const uint16_t p1 = srcPtr[1];
-            const uint16_t p2 = srcPtr[2];
-            const uint16_t p3 = srcPtr[3];
-
-            dstPtr[0] = p0 >> 6;
-            dstPtr[1] = ((p0 & 0x3F) << 2) | (p1 >> 12);
-            dstPtr[2] = (p1 >> 4) & 0xFF;
-            dstPtr[3] = ((p1 & 0x0F) << 4) | (p2 >> 10);
-            dstPtr[4] = (p2 >> 2) & 0xFF;
-            dstPtr[5] = ((p2 & 0x03) << 6) | (p3 >> 8);
-            dstPtr[6] = p3 & 0xFF;
-
-            srcPtr += 4;
-            dstPtr += 7;
+            // Both rows of a 2x2 block use the position of its top row
+            const float sy = std::max(0.0f, std::min(1.0f, ((y & ~1u) * scale + top) * shadingMapScaleY));
+            const float mapY = sy * (lensShadingMapHeight - 1);
+
+            const int y0 = static_cast<int>(std::floor(mapY));
+            const int y1 = std::min(y0 + 1, lensShadingMapHeight - 1);
+            const float wy = mapY - y0;
+
+            const float* mapRow0 = mapRows.data() + (static_cast<size_t>(y0) * 2 + (y & 1)) * width;
+            const float* mapRow1 = mapRows.data() + (static_cast<size_t>(y1) * 2 + (y & 1)) * width;
+
+            for(uint32_t x = 0; x < width; ++x)
+                dst[x] = mapRow0[x] * (1.0f - wy) + mapRow1[x] * wy;
         }
-    }
+    };
 
-    // Resize to fit new data
-    auto newSize = dstPtr - data.data();
+    // Shading maps rarely change between frames, keep the tables of the most recent ones. Tables are keyed on
+    // everything they are built from, so mounts with the same map and geometry share them.
+    std::shared_ptr<const ShadingGainTable> getShadingGainTable(
+        const CameraFrameMetadata& metadata,
+        bool normaliseShadingMap,
+        uint32_t scale,
+        int left,
+        int top,
+        uint32_t width,
+        uint32_t height,
+        const std::array<uint8_t, 4>& cfa)
+    {
+        static std::mutex cacheLock;
+        static std::list<std::shared_ptr<ShadingGainTable>> cache;
+
+        std::shared_ptr<ShadingGainTable> table;
 
-    data.resize(newSize);
+        {
+            std::lock_guard<std::mutex> lock(cacheLock);
+
+            for(auto it = cache.begin(); it != cache.end(); ++it) {
+                if((*it)->matches(metadata, normaliseShadingMap, scale, left, top, width, height, cfa)) {
+                    cache.splice(cache.begin(), cache, it);
+                    table = cache.front();
+                    break;
+                }
+            }
+
+            if(!table) {
+                table = std::make_shared<ShadingGainTable>();
+
+                table->lensShadingMap = metadata.lensShadingMap;
+                table->lensShadingMapWidth = metadata.lensShadingMapWidth;
+                table->lensShadingMapHeight = metadata.lensShadingMapHeight;
+                table->normalised = normaliseShadingMap;
+                table->scale = scale;
+                table->left = left;
+                table->top = top;
+                table->fullWidth = metadata.originalWidth;
+                table->fullHeight = metadata.originalHeight;
+                table->width = width;
+                table->height = height;
+                table->cfa = cfa;
+
+                cache.push_front(table);
+
+                while(cache.size() > SHADING_GAIN_CACHE_SIZE)
+                    cache.pop_back();
+            }
+        }
+
+        // Built outside the lock, threads that miss on the same table at once wait for the first one
+        std::call_once(table->built, [&table] { table->build(); });
+
+        return table;
+    }
 }
 
-std::tuple<std::vector<uint8_t>, std::array<unsigned short, 4>, unsigned short> preprocessData(
-    std::vector<uint8_t>& data,
-    uint32_t& inOutWidth,
-    uint32_t& inOutHeight,
+// Everything needed to render the rows of one frame, worked out before any pixel is touched
+struct RenderPlan {
+    uint32_t scale;
+    uint32_t srcWidth;
+    uint32_t width;
+    uint32_t height;
+    size_t rowBytes;
+    kernels::LinearizeParams rowParams[2];
+    std::shared_ptr<const ShadingGainTable> shadingGains;
+    std::array<unsigned short, 4> blackLevel;
+    unsigned short whiteLevel;
+    unsigned short encodeBits;
+};
+
+RenderPlan planRender(
+    uint32_t srcWidth,
+    uint32_t srcHeight,
     const CameraFrameMetadata& metadata,
     const CameraConfiguration& cameraConfiguration,
     const std::array<uint8_t, 4>& cfa,
     uint32_t scale,
     bool applyShadingMap=true,
-    bool normaliseShadingMap=false)
+    bool normaliseShadingMap=false,
+    bool withShadingGains=true)
 {
+    RenderPlan plan;
+
     if (scale > 1) {
         // Ensure even scale for downscaling
         scale = (scale / 2) * 2;
@@ -283,10 +328,10 @@ std::tuple<std::vector<uint8_t>, std::array<unsigned short, 4>, unsigned short>
     }
 
     // Calculate new dimensions
-    uint32_t newWidth = inOutWidth / scale;
-    uint32_t newHeight = inOutHeight / scale;
+    uint32_t newWidth = srcWidth / scale;
+    uint32_t newHeight = srcHeight / scale;
 
-    // Align to 4 for bayer pattern and also because we read 4 bytes at a time when encoding to 10/14 bit
+    // Align to 4 for bayer pattern and also because we pack 4 samples at a time when encoding to 10/14 bit
     newWidth = (newWidth / 4) * 4;
     newHeight = (newHeight / 4) * 4;
 
@@ -304,16 +349,11 @@ std::tuple<std::vector<uint8_t>, std::array<unsigned short, 4>, unsigned short>
     auto dstWhiteLevel = srcWhiteLevel;
 
     // Calculate shading map offsets
-    auto lensShadingMap = metadata.lensShadingMap;
-
     const int fullWidth = metadata.originalWidth;
     const int fullHeight = metadata.originalHeight;
 
-    const int left = (fullWidth - inOutWidth) / 2;
-    const int top = (fullHeight - inOutHeight) / 2;
-
-    const float shadingMapScaleX = 1.0f / static_cast<float>(fullWidth);
-    const float shadingMapScaleY = 1.0f / static_cast<float>(fullHeight);
+    const int left = (fullWidth - srcWidth) / 2;
+    const int top = (fullHeight - srcHeight) / 2;
 
     // When applying shading map, increase precision
     if(applyShadingMap) {
@@ -325,101 +365,121 @@ std::tuple<std::vector<uint8_t>, std::array<unsigned short, 4>, unsigned short>
         for(auto& v : dstBlackLevel)
             v *= (1 << (useBits - srcBits));
 
-        if(normaliseShadingMap)
-            normalizeShadingMap(lensShadingMap);
+        if(withShadingGains)
+            plan.shadingGains = getShadingGainTable(
+                metadata, normaliseShadingMap, scale, left, top, newWidth, newHeight, cfa);
     }
 
-    //
-    // Preprocess data
-    //
-
-    uint32_t originalWidth = inOutWidth;
-    uint32_t dstOffset = 0;
-
-    // Reinterpret the input data as uint16_t for reading
-    uint16_t* srcData = reinterpret_cast<uint16_t*>(data.data());
-
-    // Process the image by copying and packing 2x2 Bayer blocks
-    std::array<float, 4> shadingMapVals { 1.0f, 1.0f, 1.0f, 1.0f };
-    std::vector<uint8_t> dst;
-
-    dst.resize(sizeof(uint16_t) * newWidth * newHeight);
-    uint16_t* dstData = reinterpret_cast<uint16_t*>(dst.data());
-
-    for (auto y = 0; y < newHeight; y += 2) {
-        for (auto x = 0; x < newWidth; x += 2) {
-            // Get the source coordinates (scaled)
-            uint32_t srcY = y * scale;
-            uint32_t srcX = x * scale;
-
-            auto s0 = srcData[srcY * originalWidth + srcX];
-            auto s1 = srcData[srcY * originalWidth + srcX + 1];
-            auto s2 = srcData[(srcY + 1) * originalWidth + srcX];
-            auto s3 = srcData[(srcY + 1) * originalWidth + srcX + 1];
-
-            if(applyShadingMap) {
-                // Calculate position in shading map
-                const float sx = (srcX + left) * shadingMapScaleX;
-                const float sy = (srcY + top) * shadingMapScaleY;
-
-                // Calculate shading map
-                shadingMapVals = {
-                    getShadingMapValue(sx, sy, 0, lensShadingMap, metadata.lensShadingMapWidth, metadata.lensShadingMapHeight),
-                    getShadingMapValue(sx, sy, 1, lensShadingMap, metadata.lensShadingMapWidth, metadata.lensShadingMapHeight),
-                    getShadingMapValue(sx, sy, 2, lensShadingMap, metadata.lensShadingMapWidth, metadata.lensShadingMapHeight),
-                    getShadingMapValue(sx, sy, 3, lensShadingMap, metadata.lensShadingMapWidth, metadata.lensShadingMapHeight)
-                };
-            }
-
-            // Linearize and (maybe) apply shading map
-            const float p0 = std::max(0.0f, linear[0] * (s0 - srcBlackLevel[0]) * shadingMapVals[cfa[0]]) * (dstWhiteLevel - dstBlackLevel[0]);
-            const float p1 = std::max(0.0f, linear[1] * (s1 - srcBlackLevel[1]) * shadingMapVals[cfa[1]]) * (dstWhiteLevel - dstBlackLevel[1]);
-            const float p2 = std::max(0.0f, linear[2] * (s2 - srcBlackLevel[2]) * shadingMapVals[cfa[2]]) * (dstWhiteLevel - dstBlackLevel[2]);
-            const float p3 = std::max(0.0f, linear[3] * (s3 - srcBlackLevel[3]) * shadingMapVals[cfa[3]]) * (dstWhiteLevel - dstBlackLevel[3]);
+    // Encode to reduce size in container
+    unsigned short encodeBits = bitsNeeded(static_cast<unsigned short>(dstWhiteLevel));
 
-            s0 = std::clamp(std::round((p0 + dstBlackLevel[0])), 0.f, dstWhiteLevel);
-            s1 = std::clamp(std::round((p1 + dstBlackLevel[1])), 0.f, dstWhiteLevel);
-            s2 = std::clamp(std::round((p2 + dstBlackLevel[2])), 0.f, dstWhiteLevel);
-            s3 = std::clamp(std::round((p3 + dstBlackLevel[3])), 0.f, dstWhiteLevel);
+    if(encodeBits <= 10)
+        encodeBits = 10;
+    else if(encodeBits <= 12)
+        encodeBits = 12;
+    else if(encodeBits <= 14)
+        encodeBits = 14;
+    else
+        encodeBits = 16;
 
-            // Copy the 2x2 Bayer block
-            dstData[dstOffset]                 = static_cast<unsigned short>(s0);
-            dstData[dstOffset + 1]             = static_cast<unsigned short>(s1);
-            dstData[dstOffset + newWidth]      = static_cast<unsigned short>(s2);
-            dstData[dstOffset + newWidth + 1]  = static_cast<unsigned short>(s3);
+    // Top row of each 2x2 Bayer block uses channels 0/1, bottom row uses channels 2/3
+    for(int row = 0; row < 2; ++row) {
+        for(int col = 0; col < 2; ++col) {
+            const int c = row * 2 + col;
 
-            dstOffset += 2;
+            plan.rowParams[row].linear[col] = linear[c];
+            plan.rowParams[row].srcBlackLevel[col] = srcBlackLevel[c];
+            plan.rowParams[row].dstBlackLevel[col] = dstBlackLevel[c];
+            plan.rowParams[row].dstRange[col] = dstWhiteLevel - dstBlackLevel[c];
         }
 
-        dstOffset += newWidth;
+        plan.rowParams[row].dstWhiteLevel = dstWhiteLevel;
     }
 
-    // Update dimensions
-    inOutWidth = newWidth;
-    inOutHeight = newHeight;
-
-    std::array<unsigned short, 4> blackLevelResult;
+    plan.scale = scale;
+    plan.srcWidth = srcWidth;
+    plan.width = newWidth;
+    plan.height = newHeight;
+    plan.rowBytes = static_cast<size_t>(newWidth) * encodeBits / 8;
+    plan.whiteLevel = static_cast<unsigned short>(dstWhiteLevel);
+    plan.encodeBits = encodeBits;
 
     for(auto i = 0; i < dstBlackLevel.size(); ++i)
-        blackLevelResult[i] = static_cast<unsigned short>(std::round(dstBlackLevel[i]));
+        plan.blackLevel[i] = static_cast<unsigned short>(std::round(dstBlackLevel[i]));
 
-    return std::make_tuple(dst, blackLevelResult, static_cast<unsigned short>(dstWhiteLevel));
+    return plan;
 }
 
-std::shared_ptr<std::vector<char>> generateDng(
-    std::vector<uint8_t>& data,
-    const CameraFrameMetadata& metadata,
-    const CameraConfiguration& cameraConfiguration,
-    float recordingFps,
-    int frameNumber,
-    FileRenderOptions options,
-    int scale)
+// Linearises, (maybe) applies the shading map and packs output rows [rowBegin, rowEnd) into dst, which points at
+// the packed output of rowBegin. Rows are packed as soon as they are linearised, so the output is written once.
+void renderRows(
+    const RenderPlan& plan,
+    const uint16_t* srcData,
+    uint8_t* dst,
+    uint32_t rowBegin,
+    uint32_t rowEnd)
 {
-    Measure m("generateDng");
+    Measure m("renderRows");
+
+    const auto newWidth = plan.width;
+    const auto scale = plan.scale;
 
-    unsigned int width = metadata.width;
-    unsigned int height = metadata.height;
+    std::vector<uint16_t> linearRow(newWidth);
+    std::vector<float> gainRow(plan.shadingGains ? newWidth : 0);
 
+    // Scratch rows for the downscaled source samples
+    std::vector<uint16_t> srcRows[2];
+
+    if(scale > 1) {
+        srcRows[0].resize(newWidth);
+        srcRows[1].resize(newWidth);
+    }
+
+    for (auto y = rowBegin; y < rowEnd; y += 2) {
+        // Get the source coordinates (scaled)
+        const size_t srcY = static_cast<size_t>(y) * scale;
+
+        const uint16_t* srcRow[2] = {
+            srcData + srcY * plan.srcWidth,
+            srcData + (srcY + 1) * plan.srcWidth
+        };
+
+        if(scale > 1) {
+            for (auto x = 0; x < newWidth; x += 2) {
+                const uint32_t srcX = x * scale;
+
+                for(int row = 0; row < 2; ++row) {
+                    srcRows[row][x]     = srcRow[row][srcX];
+                    srcRows[row][x + 1] = srcRow[row][srcX + 1];
+                }
+            }
+
+            srcRow[0] = srcRows[0].data();
+            srcRow[1] = srcRows[1].data();
+        }
+
+        for(int row = 0; row < 2; ++row) {
+            if(plan.shadingGains)
+                plan.shadingGains->getRow(y + row, gainRow.data());
+
+            kernels::linearizeRow(
+                srcRow[row],
+                plan.shadingGains ? gainRow.data() : nullptr,
+                linearRow.data(),
+                newWidth,
+                plan.rowParams[row]);
+
+            kernels::packRow(linearRow.data(), dst + (y - rowBegin + row) * plan.rowBytes, newWidth, plan.encodeBits);
+        }
+    }
+}
+
+void checkFrameData(const std::vector<uint8_t>& data, const CameraFrameMetadata& metadata) {
+    if(data.size() < static_cast<size_t>(metadata.width) * metadata.height * sizeof(uint16_t))
+        throw std::runtime_error("Frame data is smaller than expected");
+}
+
+std::array<uint8_t, 4> getCfa(const CameraConfiguration& cameraConfiguration) {
     std::array<uint8_t, 4> cfa;
 
     if(cameraConfiguration.sensorArrangement == "rggb")
@@ -433,67 +493,52 @@ std::shared_ptr<std::vector<char>> generateDng(
     else
         throw std::runtime_error("Invalid sensor arrangement");
 
-    // Scale down if requested
-    bool applyShadingMap = options & RENDER_OPT_APPLY_VIGNETTE_CORRECTION;
-    bool normalizeShadingMap = options & RENDER_OPT_NORMALIZE_SHADING_MAP;
+    return cfa;
+}
 
-    auto [processedData, dstBlackLevel, dstWhiteLevel] = utils::preprocessData(
-        data,
-        width, height,
-        metadata,
-        cameraConfiguration,
-        cfa,
-        scale,
-        applyShadingMap, normalizeShadingMap);
+// Fills in every tag, the layout only depends on the plan and camera configuration so it is the same for all
+// frames of a recording
+DngWriter createDngWriter(
+    const RenderPlan& plan,
+    const std::array<uint8_t, 4>& cfa,
+    const CameraFrameMetadata& metadata,
+    const CameraConfiguration& cameraConfiguration,
+    float recordingFps,
+    int frameNumber)
+{
+    const auto& dstBlackLevel = plan.blackLevel;
 
-    spdlog::debug("New black level {},{},{},{} and white level {}",
-                  dstBlackLevel[0], dstBlackLevel[1], dstBlackLevel[2], dstBlackLevel[3], dstWhiteLevel);
+    const uint32_t width = plan.width;
+    const uint32_t height = plan.height;
 
-    // Encode to reduce size in container
-    auto encodeBits = bitsNeeded(dstWhiteLevel);
+    DngWriter dng(width, height, plan.encodeBits);
 
-    if(encodeBits <= 10) {
-        utils::encodeTo10Bit(processedData, width, height);
-        encodeBits = 10;
-    }
-    else if(encodeBits <= 12) {
-        utils::encodeTo12Bit(processedData, width, height);
-        encodeBits = 12;
-    }
-    else if(encodeBits <= 14) {
-        utils::encodeTo14Bit(processedData, width, height);
-        encodeBits = 14;
-    }
-    else {
-        encodeBits = 16;
-    }
+    const uint8_t dngVersion[4] = { 1, 4, 0, 0 };
+    const uint8_t dngBackwardVersion[4] = { 1, 1, 0, 0 };
+
+    dng.setByte(DNG_TAG_DNG_VERSION, dngVersion, 4);
+    dng.setByte(DNG_TAG_DNG_BACKWARD_VERSION, dngBackwardVersion, 4);
+
+    const uint16_t cfaRepeatPatternDim[2] = { 2, 2 };
+
+    dng.setShort(DNG_TAG_CFA_REPEAT_PATTERN_DIM, cfaRepeatPatternDim, 2);
+    dng.setByte(DNG_TAG_CFA_PATTERN, cfa.data(), 4);
 
-    // Create first frame
-    tinydngwriter::DNGImage dng;
-
-    dng.SetBigEndian(false);
-    dng.SetDNGVersion(1, 4, 0, 0);
-    dng.SetDNGBackwardVersion(1, 1, 0, 0);
-    dng.SetImageData(reinterpret_cast<const unsigned char*>(processedData.data()), processedData.size());
-    dng.SetImageWidth(width);
-    dng.SetImageLength(height);
-    dng.SetPlanarConfig(tinydngwriter::PLANARCONFIG_CONTIG);
-    dng.SetPhotometric(tinydngwriter::PHOTOMETRIC_CFA);
-    dng.SetRowsPerStrip(height);
-    dng.SetSamplesPerPixel(1);
-    dng.SetCFARepeatPatternDim(2, 2);
-    dng.SetXResolution(300);
-    dng.SetYResolution(300);
-
-    dng.SetBlackLevelRepeatDim(2, 2);
-    dng.SetBlackLevel(4, dstBlackLevel.data());
-    dng.SetWhiteLevel(dstWhiteLevel);
-    dng.SetCompression(tinydngwriter::COMPRESSION_NONE);
-
-    dng.SetIso(metadata.iso);
-    dng.SetExposureTime(metadata.exposureTime / 1e9);
-
-    dng.SetCFAPattern(4, cfa.data());
+    // Rectangular
+    dng.setShort(DNG_TAG_CFA_LAYOUT, 1);
+
+    dng.setRational(DNG_TAG_X_RESOLUTION, 300, 1);
+    dng.setRational(DNG_TAG_Y_RESOLUTION, 300, 1);
+
+    dng.setShort(DNG_TAG_BLACK_LEVEL_REPEAT_DIM, cfaRepeatPatternDim, 2);
+    dng.setShort(DNG_TAG_BLACK_LEVEL, dstBlackLevel.data(), 4);
+    dng.setShort(DNG_TAG_WHITE_LEVEL, plan.whiteLevel);
+
+    const uint16_t iso = static_cast<uint16_t>(std::clamp(metadata.iso, 0, 65535));
+    const float exposureTime = static_cast<float>(metadata.exposureTime / 1e9);
+
+    dng.setShort(DNG_TAG_ISO_SPEED_RATINGS, iso);
+    dng.setRational(DNG_TAG_EXPOSURE_TIME, &exposureTime, 1);
 
     // Add orientation tag
     DngOrientation dngOrientation;
@@ -522,7 +567,7 @@ std::shared_ptr<std::vector<char>> generateDng(
         break;
     }
 
-    dng.SetOrientation(dngOrientation);
+    dng.setShort(DNG_TAG_ORIENTATION, static_cast<uint16_t>(dngOrientation));
 
     // Time code
     float time = frameNumber / recordingFps;
@@ -532,68 +577,221 @@ std::shared_ptr<std::vector<char>> generateDng(
     int seconds = ((int) floor(time)) % 60;
     int frames = recordingFps > 1 ? (frameNumber % static_cast<int>(std::round(recordingFps))) : 0;
 
-    std::vector<uint8_t> timeCode(8);
+    uint8_t timeCode[8] = { 0 };
 
     timeCode[0] = ToTimecodeByte(frames) & 0x3F;
     timeCode[1] = ToTimecodeByte(seconds) & 0x7F;
     timeCode[2] = ToTimecodeByte(minutes) & 0x7F;
     timeCode[3] = ToTimecodeByte(hours) & 0x3F;
 
-    dng.SetTimeCode(timeCode.data());
-    dng.SetFrameRate(recordingFps);
-
-    // Rectangular
-    dng.SetCFALayout(1);
+    dng.setByte(DNG_TAG_TIME_CODES, timeCode, 8);
 
-    const uint16_t bps[1] = { encodeBits };
-    dng.SetBitsPerSample(1, bps);
+    auto frameRate = toFraction(recordingFps);
+    dng.setSRational(DNG_TAG_FRAME_RATE, frameRate.first, frameRate.second);
 
-    dng.SetColorMatrix1(3, cameraConfiguration.colorMatrix1.data());
-    dng.SetColorMatrix2(3, cameraConfiguration.colorMatrix2.data());
+    dng.setSRational(DNG_TAG_COLOR_MATRIX1, cameraConfiguration.colorMatrix1.data(), 9);
+    dng.setSRational(DNG_TAG_COLOR_MATRIX2, cameraConfiguration.colorMatrix2.data(), 9);
 
-    dng.SetForwardMatrix1(3, cameraConfiguration.forwardMatrix1.data());
-    dng.SetForwardMatrix2(3, cameraConfiguration.forwardMatrix2.data());
+    dng.setSRational(DNG_TAG_FORWARD_MATRIX1, cameraConfiguration.forwardMatrix1.data(), 9);
+    dng.setSRational(DNG_TAG_FORWARD_MATRIX2, cameraConfiguration.forwardMatrix2.data(), 9);
 
-    dng.SetCameraCalibration1(3, IDENTITY_MATRIX);
-    dng.SetCameraCalibration2(3, IDENTITY_MATRIX);
+    dng.setSRational(DNG_TAG_CAMERA_CALIBRATION1, IDENTITY_MATRIX, 9);
+    dng.setSRational(DNG_TAG_CAMERA_CALIBRATION2, IDENTITY_MATRIX, 9);
 
-    dng.SetAsShotNeutral(3, metadata.asShotNeutral.data());
+    dng.setRational(DNG_TAG_AS_SHOT_NEUTRAL, metadata.asShotNeutral.data(), 3);
 
-    dng.SetCalibrationIlluminant1(getColorIlluminant(cameraConfiguration.colorIlluminant1));
-    dng.SetCalibrationIlluminant2(getColorIlluminant(cameraConfiguration.colorIlluminant2));
+    dng.setShort(DNG_TAG_CALIBRATION_ILLUMINANT1, getColorIlluminant(cameraConfiguration.colorIlluminant1));
+    dng.setShort(DNG_TAG_CALIBRATION_ILLUMINANT2, getColorIlluminant(cameraConfiguration.colorIlluminant2));
 
     // Additional information
-    const auto software = "MotionCam Tools";
+    dng.setAscii(DNG_TAG_SOFTWARE, "MotionCam Tools");
+    dng.setAscii(DNG_TAG_UNIQUE_CAMERA_MODEL, cameraConfiguration.extraData.postProcessSettings.metadata.buildModel);
 
-    dng.SetSoftware(software);
-    dng.SetUniqueCameraModel(cameraConfiguration.extraData.postProcessSettings.metadata.buildModel);
+    const uint32_t activeArea[4] = { 0, 0, height, width };
+    dng.setLong(DNG_TAG_ACTIVE_AREA, activeArea, 4);
 
-    // Set data
-    dng.SetSubfileType();
 
-    const uint32_t activeArea[4] = { 0, 0, height, width };
-    dng.SetActiveArea(&activeArea[0]);
+    return dng;
+}
 
-    // Write DNG
-    std::string err;
+std::shared_ptr<std::vector<char>> generateDng(
+    std::vector<uint8_t>& data,
+    const CameraFrameMetadata& metadata,
+    const CameraConfiguration& cameraConfiguration,
+    float recordingFps,
+    int frameNumber,
+    FileRenderOptions options,
+    int scale)
+{
+    Measure m("generateDng");
 
-    tinydngwriter::DNGWriter writer(false);
+    const auto cfa = getCfa(cameraConfiguration);
 
-    writer.AddImage(&dng);
+    // Scale down if requested
+    bool applyShadingMap = options & RENDER_OPT_APPLY_VIGNETTE_CORRECTION;
+    bool normalizeShadingMap = options & RENDER_OPT_NORMALIZE_SHADING_MAP;
 
-    // Save to memory
-    auto output = std::make_shared<std::vector<char>>();
+    const auto plan = planRender(
+        metadata.width, metadata.height,
+        metadata,
+        cameraConfiguration,
+        cfa,
+        scale,
+        applyShadingMap, normalizeShadingMap);
+
+    spdlog::debug("New black level {},{},{},{} and white level {}",
+                  plan.blackLevel[0], plan.blackLevel[1], plan.blackLevel[2], plan.blackLevel[3], plan.whiteLevel);
+
+    checkFrameData(data, metadata);
+
+    auto dng = createDngWriter(plan, cfa, metadata, cameraConfiguration, recordingFps, frameNumber);
+
+    // Allocate the whole file once and render the pixels straight into it after the header
+    auto output = std::make_shared<std::vector<char>>(dng.fileSize());
+    auto* fileData = reinterpret_cast<uint8_t*>(output->data());
+
+    dng.writeHeader(fileData);
+
+    renderRows(plan, reinterpret_cast<const uint16_t*>(data.data()), fileData + dng.headerSize(), 0, plan.height);
+
+    return output;
+}
+
+std::shared_ptr<std::vector<char>> generateDngHeader(
+    const CameraFrameMetadata& metadata,
+    const CameraConfiguration& cameraConfiguration,
+    float recordingFps,
+    int frameNumber,
+    FileRenderOptions options,
+    int scale)
+{
+    const auto cfa = getCfa(cameraConfiguration);
 
-    // Reserve enough to fit the data
-    output->reserve(width*height*sizeof(uint16_t) + 512*1024);
+    bool applyShadingMap = options & RENDER_OPT_APPLY_VIGNETTE_CORRECTION;
+    bool normalizeShadingMap = options & RENDER_OPT_NORMALIZE_SHADING_MAP;
+
+    // Only the levels and encoding are needed, skip building the shading gains
+    const auto plan = planRender(
+        metadata.width, metadata.height,
+        metadata,
+        cameraConfiguration,
+        cfa,
+        scale,
+        applyShadingMap, normalizeShadingMap,
+        false);
 
-    utils::vector_ostream stream(*output);
+    auto dng = createDngWriter(plan, cfa, metadata, cameraConfiguration, recordingFps, frameNumber);
+    auto output = std::make_shared<std::vector<char>>(dng.headerSize());
 
-    writer.WriteToFile(stream, &err);
+    dng.writeHeader(reinterpret_cast<uint8_t*>(output->data()));
 
     return output;
 }
 
+DngLayout getDngLayout(
+    const CameraFrameMetadata& metadata,
+    const CameraConfiguration& cameraConfiguration,
+    float recordingFps,
+    FileRenderOptions options,
+    int scale)
+{
+    const auto cfa = getCfa(cameraConfiguration);
+
+    bool applyShadingMap = options & RENDER_OPT_APPLY_VIGNETTE_CORRECTION;
+    bool normalizeShadingMap = options & RENDER_OPT_NORMALIZE_SHADING_MAP;
+
+    const auto plan = planRender(
+        metadata.width, metadata.height,
+        metadata,
+        cameraConfiguration,
+        cfa,
+        scale,
+        applyShadingMap, normalizeShadingMap,
+        false);
+
+    auto dng = createDngWriter(plan, cfa, metadata, cameraConfiguration, recordingFps, 0);
+
+    return DngLayout{ dng.headerSize(), plan.rowBytes, plan.width, plan.height };
+}
+
+void renderDngRows(
+    const std::vector<uint8_t>& data,
+    const CameraFrameMetadata& metadata,
+    const CameraConfiguration& cameraConfiguration,
+    FileRenderOptions options,
+    int scale,
+    const DngLayout& layout,
+    uint32_t rowBegin,
+    uint32_t rowEnd,
+    uint8_t* dst)
+{
+    const auto cfa = getCfa(cameraConfiguration);
+
+    bool applyShadingMap = options & RENDER_OPT_APPLY_VIGNETTE_CORRECTION;
+    bool normalizeShadingMap = options & RENDER_OPT_NORMALIZE_SHADING_MAP;
+
+    const auto plan = planRender(
+        metadata.width, metadata.height,
+        metadata,
+        cameraConfiguration,
+        cfa,
+        scale,
+        applyShadingMap, normalizeShadingMap);
+
+    checkFrameData(data, metadata);
+
+    // Frames with other dimensions or a dynamic white level that needs more bits don't fit the layout of the
+    // recording, rendering them would write past dst
+    if(plan.rowBytes != layout.rowBytes || plan.width != layout.width || plan.height != layout.height)
+        throw std::runtime_error("Frame does not match the layout of the recording");
+
+    if(rowBegin % 2 != 0 || rowEnd % 2 != 0 || rowEnd > plan.height)
+        throw std::runtime_error("Invalid row range");
+
+    renderRows(plan, reinterpret_cast<const uint16_t*>(data.data()), dst, rowBegin, rowEnd);
+}
+
+void renderDngBytes(
+    const std::vector<uint8_t>& data,
+    const CameraFrameMetadata& metadata,
+    const CameraConfiguration& cameraConfiguration,
+    FileRenderOptions options,
+    int scale,
+    const DngLayout& layout,
+    size_t begin,
+    size_t end,
+    uint8_t* dst)
+{
+    if(begin > end || end > layout.rowBytes * layout.height)
+        throw std::runtime_error("Invalid byte range");
+
+    if(begin == end)
+        return;
+
+    // Rows are rendered in pairs, the CFA pattern repeats every two rows
+    const auto rowBegin = static_cast<uint32_t>(begin / layout.rowBytes) & ~1u;
+    auto rowEnd = static_cast<uint32_t>((end + layout.rowBytes - 1) / layout.rowBytes);
+
+    rowEnd = (std::min)(rowEnd + rowEnd % 2, layout.height);
+
+    const size_t renderBegin = rowBegin * layout.rowBytes;
+    const size_t renderEnd = rowEnd * layout.rowBytes;
+
+    if(renderBegin == begin && renderEnd == end) {
+        renderDngRows(data, metadata, cameraConfiguration, options, scale, layout, rowBegin, rowEnd, dst);
+        return;
+    }
+
+    // Otherwise the range is cut out of the rows overlapping it
+    thread_local std::vector<uint8_t> rows;
+
+    rows.resize(renderEnd - renderBegin);
+
+    renderDngRows(data, metadata, cameraConfiguration, options, scale, layout, rowBegin, rowEnd, rows.data());
+
+    std::memcpy(dst, rows.data() + (begin - renderBegin), end - begin);
+}
+
 int gcd(int a, int b) {
     while (b != 0) {
         int temp = b;
@@ -4,6 +4,8 @@
 #include "Utils.h"
 #include "AudioWriter.h"
 #include "LRUCache.h"
+#include "DiskCache.h"
+#include "TaskScheduler.h"
 
 #include <motioncam/Decoder.hpp>
 
@@ -11,13 +13,18 @@
 #include <boost/regex.hpp>
 #include <boost/algorithm/string.hpp>
 
-#include <BS_thread_pool.hpp>
 #include <spdlog/spdlog.h>
 #include <audiofile/AudioFile.h>
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
 #include <sstream>
 #include <tuple>
+#include <unordered_map>
 
 namespace motioncam {
 
@@ -115,143 +122,380 @@ IconSize=16
         return oss.str();
     }
 
-    void syncAudio(Timestamp videoTimestamp, std::vector<AudioChunk>& audioChunks, int sampleRate, int numChannels) {
+    // Returns how many samples the audio is shifted by to line up with the video. Positive values are silence added
+    // to the start, negative values are samples trimmed from it.
+    int64_t getAudioSyncOffset(Timestamp videoTimestamp, Timestamp audioTimestamp, int sampleRate, int numChannels) {
         // Calculate drift between the video and audio
-        auto audioVideoDriftMs = (audioChunks[0].first - videoTimestamp) * 1e-6f;
+        auto audioVideoDriftMs = (audioTimestamp - videoTimestamp) * 1e-6f;
         if(std::abs(audioVideoDriftMs) > 1000) {
             spdlog::warn("Audio drift too large, not syncing audio");
-            return;
+            return 0;
         }
 
-        if(audioVideoDriftMs > 0) {
-            // Calculate how many audio frames to remove
-            int audioFramesToRemove = static_cast<int>(std::round(audioVideoDriftMs * sampleRate / 1000));
-            int samplesToRemove = audioFramesToRemove * numChannels;
+        const auto audioFrames = static_cast<int64_t>(std::round(std::abs(audioVideoDriftMs) * sampleRate / 1000));
 
-            // Remove samples from the beginning of audio chunks
-            int samplesRemoved = 0;
-            auto it = audioChunks.begin();
+        // Audio that starts after the video is trimmed, otherwise silence is added
+        return (audioVideoDriftMs > 0 ? -audioFrames : audioFrames) * numChannels;
+    }
 
-            while(it != audioChunks.end() && samplesRemoved < samplesToRemove) {
-                int remainingSamplesToRemove = samplesToRemove - samplesRemoved;
+    int getScaleFromOptions(FileRenderOptions options, int draftScale) {
+        if(options & RENDER_OPT_DRAFT)
+            return draftScale;
 
-                if(it->second.size() <= remainingSamplesToRemove) {
-                    // Remove entire chunk
-                    samplesRemoved += it->second.size();
-                    it = audioChunks.erase(it);
-                }
-                else {
-                    // Trim partial chunk from the beginning
-                    it->second.erase(it->second.begin(), it->second.begin() + remainingSamplesToRemove);
+        return 1;
+    }
 
-                    // Update timestamp for the trimmed chunk
-                    it->first += static_cast<Timestamp>(remainingSamplesToRemove * 1000 / sampleRate);
-                    break;
-                }
-            }
+    // Each DNG is cached in segments, the header followed by fixed size pages of pixel data. Pages are evicted
+    // independently, so memory only goes to the parts of a frame that are read.
+    constexpr size_t DNG_PAGE_SIZE = 256 * 1024;
+
+    // Decoded frames kept around so reads of neighbouring pages don't decode the frame again
+    constexpr size_t DECODED_FRAME_CACHE_SIZE = 4;
+
+    // The samples of audio.wav are cached in pages, under a frame index no frame uses
+    constexpr size_t AUDIO_PAGE_SIZE = 1024 * 1024;
+    constexpr int64_t AUDIO_FRAME_INDEX = -1;
+
+    // Loading audio reads all of it from the container, pages this far past a read are kept for the next reads
+    constexpr int64_t AUDIO_READ_AHEAD_PAGES = 32;
+
+    // Audio is stored on disk as one entry, the chunk offsets and the header of audio.wav followed by its pages
+    constexpr uint64_t AUDIO_RENDER_ID = 1; // Bump when the audio on disk changes
+    constexpr size_t AUDIO_OFFSETS_SEGMENT = 0;
+    constexpr size_t AUDIO_HEADER_SEGMENT = 1;
+    constexpr size_t AUDIO_FIRST_PAGE_SEGMENT = 2;
+
+    // Read-ahead starts once this many consecutive frames were read in the same direction
+    constexpr int READ_AHEAD_MIN_SEQUENTIAL_READS = 2;
+    constexpr int64_t READ_AHEAD_DEFAULT_DEPTH = 2;
+    constexpr int64_t READ_AHEAD_MAX_DEPTH = 16;
+
+    // At most this fraction of the cache is spent on frames that haven't been read yet
+    constexpr size_t READ_AHEAD_CACHE_FRACTION = 4;
+
+    // Weight of the newest sample in the consumption rate and render time averages
+    constexpr double READ_AHEAD_SMOOTHING = 0.25;
+
+    int64_t getSegment(const utils::DngLayout& layout, size_t pos) {
+        if(pos < layout.headerSize)
+            return 0;
+
+        return 1 + static_cast<int64_t>((pos - layout.headerSize) / DNG_PAGE_SIZE);
+    }
+
+    // Byte range of the segment in the file
+    std::pair<size_t, size_t> getSegmentRange(const utils::DngLayout& layout, int64_t segment) {
+        if(segment == 0)
+            return { 0, layout.headerSize };
+
+        const size_t begin = layout.headerSize + static_cast<size_t>(segment - 1) * DNG_PAGE_SIZE;
+
+        return { begin, (std::min)(begin + DNG_PAGE_SIZE, layout.fileSize()) };
+    }
+
+    size_t getSegmentOffset(const utils::DngLayout& layout, int64_t segment) {
+        return getSegmentRange(layout, segment).first;
+    }
+
+    std::shared_ptr<std::vector<char>> renderPage(
+        const utils::DngLayout& layout,
+        int64_t segment,
+        const std::vector<uint8_t>& data,
+        const CameraFrameMetadata& metadata,
+        const CameraConfiguration& cameraConfiguration,
+        FileRenderOptions options,
+        int scale)
+    {
+        const auto [begin, end] = getSegmentRange(layout, segment);
+
+        auto page = std::make_shared<std::vector<char>>(end - begin);
+
+        utils::renderDngBytes(
+            data, metadata, cameraConfiguration, options, scale, layout, begin - layout.headerSize, end - layout.headerSize,
+            reinterpret_cast<uint8_t*>(page->data()));
+
+        return page;
+    }
+
+    // Copies the part of the segment that overlaps the read
+    void copySegment(
+        const utils::DngLayout& layout,
+        int64_t segment,
+        const char* data,
+        size_t size,
+        size_t pos,
+        size_t len,
+        void* dst)
+    {
+        const size_t segmentBegin = getSegmentOffset(layout, segment);
+        const size_t segmentEnd = segmentBegin + size;
+
+        const size_t begin = (std::max)(pos, segmentBegin);
+        const size_t end = (std::min)(pos + len, segmentEnd);
+
+        if(begin < end)
+            std::memcpy(static_cast<char*>(dst) + (begin - pos), data + (begin - segmentBegin), end - begin);
+    }
+
+    // Frames on disk were written with some layout, it has to be the one reads are mapped with
+    bool matchesLayout(const DiskCacheFrame& frame, const utils::DngLayout& layout) {
+        const auto numSegments = static_cast<size_t>(getSegment(layout, layout.fileSize() - 1) + 1);
+
+        if(frame.numSegments() != numSegments)
+            return false;
+
+        for(size_t segment = 0; segment < numSegments; ++segment) {
+            const auto [begin, end] = getSegmentRange(layout, static_cast<int64_t>(segment));
+
+            if(frame.segmentSize(segment) != end - begin)
+                return false;
         }
-        else {
-            // Otherwise video starts before audio, add silence
-            auto silenceDuration = -audioVideoDriftMs; // Make positive
 
-            int silenceFrames = static_cast<int>(std::round(silenceDuration * sampleRate / 1000));
-            int silenceSamples = silenceFrames * numChannels;
+        return true;
+    }
+
+    // Copies the samples of an audio page out of the chunks, chunkOffsets holds where each chunk starts followed by the end
+    std::shared_ptr<std::vector<char>> renderAudioPage(
+        const std::vector<AudioChunk>& audioChunks,
+        const std::vector<int64_t>& chunkOffsets,
+        uint64_t dataSize,
+        int64_t page)
+    {
+        if(audioChunks.size() + 1 != chunkOffsets.size())
+            throw std::runtime_error("Audio does not match the index");
+
+        const int64_t pageBegin = page * static_cast<int64_t>(AUDIO_PAGE_SIZE);
+        const int64_t pageEnd = (std::min)(pageBegin + static_cast<int64_t>(AUDIO_PAGE_SIZE), static_cast<int64_t>(dataSize));
+
+        // Zero filled, so silence added to sync the audio needs no copying
+        auto data = std::make_shared<std::vector<char>>(pageEnd - pageBegin, 0);
+
+        // Chunk the page begins in, the last one that starts at or before it
+        auto it = std::upper_bound(chunkOffsets.begin(), chunkOffsets.end() - 1, pageBegin);
+        size_t chunk = (it == chunkOffsets.begin()) ? 0 : static_cast<size_t>(it - chunkOffsets.begin() - 1);
 
-            // Create silence chunk at the beginning
-            std::vector<int16_t> silenceData(silenceSamples, 0);
-            AudioChunk silenceChunk = std::make_pair(videoTimestamp, silenceData);
+        for(; chunk < audioChunks.size() && chunkOffsets[chunk] < pageEnd; ++chunk) {
+            const int64_t chunkBegin = chunkOffsets[chunk];
+            const int64_t chunkEnd = chunkOffsets[chunk + 1];
 
-            // Insert silence at the beginning
-            audioChunks.insert(audioChunks.begin(), silenceChunk);
+            const int64_t begin = (std::max)(pageBegin, chunkBegin);
+            const int64_t end = (std::min)(pageEnd, chunkEnd);
 
-            // Update timestamps of existing chunks
-            for(auto it = audioChunks.begin() + 1; it != audioChunks.end(); ++it) {
-                it->first += silenceDuration;
+            if(begin < end) {
+                const auto* samples = reinterpret_cast<const char*>(audioChunks[chunk].second.data());
+
+                std::memcpy(data->data() + (begin - pageBegin), samples + (begin - chunkBegin), end - begin);
             }
         }
+
+        return data;
     }
 
-    int getScaleFromOptions(FileRenderOptions options, int draftScale) {
-        if(options & RENDER_OPT_DRAFT)
-            return draftScale;
+    int64_t getAudioPageCount(uint64_t dataSize) {
+        return static_cast<int64_t>((dataSize + AUDIO_PAGE_SIZE - 1) / AUDIO_PAGE_SIZE);
+    }
 
-        return 1;
+    // Renders every page, each chunk is released once the pages it lands in are done so the samples are only held once
+    std::vector<std::shared_ptr<std::vector<char>>> renderAudioPages(
+        std::vector<AudioChunk>& audioChunks,
+        const std::vector<int64_t>& chunkOffsets,
+        uint64_t dataSize)
+    {
+        std::vector<std::shared_ptr<std::vector<char>>> pages;
+        const auto numPages = getAudioPageCount(dataSize);
+
+        pages.reserve(numPages);
+
+        size_t released = 0;
+
+        for(int64_t page = 0; page < numPages; ++page) {
+            pages.push_back(renderAudioPage(audioChunks, chunkOffsets, dataSize, page));
+
+            const int64_t pageEnd = (page + 1) * static_cast<int64_t>(AUDIO_PAGE_SIZE);
+
+            for(; released < audioChunks.size() && chunkOffsets[released + 1] <= pageEnd; ++released)
+                std::vector<int16_t>().swap(audioChunks[released].second);
+        }
+
+        return pages;
+    }
+
+    DiskCacheKey getAudioDiskKey(uint64_t sourceId) {
+        return DiskCacheKey{ sourceId, AUDIO_RENDER_ID, AUDIO_FRAME_INDEX };
+    }
+
+    // Size of the samples of the audio on disk, -1 if its segments don't add up
+    int64_t getDiskAudioDataSize(const DiskCacheFrame& audio) {
+        if(audio.numSegments() < AUDIO_FIRST_PAGE_SEGMENT)
+            return -1;
+
+        const size_t offsetsSize = audio.segmentSize(AUDIO_OFFSETS_SEGMENT);
+
+        if(offsetsSize < 2 * sizeof(int64_t) || offsetsSize % sizeof(int64_t) != 0 || audio.segmentSize(AUDIO_HEADER_SEGMENT) == 0)
+            return -1;
+
+        // Last offset is the end of the samples
+        int64_t end;
+
+        std::memcpy(&end, audio.segmentData(AUDIO_OFFSETS_SEGMENT) + offsetsSize - sizeof(end), sizeof(end));
+
+        const auto dataSize = static_cast<uint64_t>((std::max)(end, static_cast<int64_t>(0)));
+        const auto numPages = getAudioPageCount(dataSize);
+
+        if(audio.numSegments() != AUDIO_FIRST_PAGE_SEGMENT + static_cast<size_t>(numPages))
+            return -1;
+
+        for(int64_t page = 0; page < numPages; ++page) {
+            const uint64_t pageBegin = static_cast<uint64_t>(page) * AUDIO_PAGE_SIZE;
+
+            if(audio.segmentSize(AUDIO_FIRST_PAGE_SEGMENT + page) != (std::min)(static_cast<uint64_t>(AUDIO_PAGE_SIZE), dataSize - pageBegin))
+                return -1;
+        }
+
+        return static_cast<int64_t>(dataSize);
+    }
+
+    // Copies the part of an audio page that overlaps [pos, pos + len) of the sample data
+    void copyAudioPage(int64_t page, const std::vector<char>& data, uint64_t pos, size_t len, void* dst) {
+        const uint64_t pageBegin = static_cast<uint64_t>(page) * AUDIO_PAGE_SIZE;
+        const uint64_t pageEnd = pageBegin + data.size();
+
+        const uint64_t begin = (std::max)(pos, pageBegin);
+        const uint64_t end = (std::min)(pos + len, pageEnd);
+
+        if(begin < end)
+            std::memcpy(static_cast<char*>(dst) + (begin - pos), data.data() + (begin - pageBegin), end - begin);
+    }
+
+    // Identifies the render settings in disk cache keys, bump the version when the rendered output changes
+    constexpr uint64_t DISK_CACHE_RENDER_VERSION = 2;
+
+    uint64_t getRenderId(FileRenderOptions options, int draftScale) {
+        return (DISK_CACHE_RENDER_VERSION << 48) |
+               (static_cast<uint64_t>(options) << 16) |
+               static_cast<uint64_t>(getScaleFromOptions(options, draftScale) & 0xFFFF);
+    }
+
+    // Reads that are cancelled before they start complete with ECANCELED, synchronous reads can't be cancelled
+    int scheduleRead(
+        TaskScheduler& scheduler,
+        std::function<size_t()> task,
+        std::function<void(size_t, int)> result,
+        std::function<bool()> isCancelled,
+        bool async)
+    {
+        if(!async)
+            return static_cast<int>(scheduler.submitTask(TASK_PRIORITY_FOREGROUND, std::move(task)).get());
+
+        scheduler.submit(
+            TASK_PRIORITY_FOREGROUND,
+            [task = std::move(task)]() { task(); },
+            std::move(isCancelled),
+            [result = std::move(result)]() { result(0, ECANCELED); });
+
+        return READ_PENDING;
+    }
+
+    // Identifies the mount in cache keys, the cache is shared by all mounts
+    uint32_t nextMountId() {
+        static std::atomic<uint32_t> mountId{0};
+
+        return mountId++;
     }
 }
 
 VirtualFileSystemImpl_MCRAW::VirtualFileSystemImpl_MCRAW(
-        BS::thread_pool& ioThreadPool,
-        BS::thread_pool& processingThreadPool,
+        TaskScheduler& ioThreadPool,
+        TaskScheduler& processingThreadPool,
         LRUCache& lruCache,
+        DiskCache& diskCache,
         FileRenderOptions options,
         int draftScale,
         const std::string& file) :
         mCache(lruCache),
+        mDiskCache(diskCache),
         mIoThreadPool(ioThreadPool),
         mProcessingThreadPool(processingThreadPool),
         mSrcPath(file),
+        mDecoderPool(DecoderPool::create(file, ioThreadPool.getThreadCount())),
         mBaseName(extractFilenameWithoutExtension(file)),
-        mTypicalDngSize(0),
+        mMountId(nextMountId()),
+        mSourceId(DiskCache::getSourceId(file)),
+        mAudioDataSize(0),
         mFps(0),
         mTotalFrames(0),
         mDroppedFrames(0),
         mWidth(0),
         mHeight(0),
-        mDraftScale(draftScale),
-        mOptions(options) {
+        mLastReadTimestamp(-1),
+        mReadAheadEpoch(0),
+        mStopping(false) {
 
-    init(options);
+    init(options, draftScale);
 }
 
 VirtualFileSystemImpl_MCRAW::~VirtualFileSystemImpl_MCRAW() {
+    // Prefetches run on the shared pool and use this instance, cancel the queued ones and wait for the rest
+    mStopping = true;
+
+    {
+        std::unique_lock<std::mutex> lock(mReadAheadLock);
+        mReadAheadDone.wait(lock, [this] { return mReadAhead.inFlight == 0 && mDiskWrites.empty(); });
+    }
+
     spdlog::info("Destroying VirtualFileSystemImpl_MCRAW({})", mSrcPath);
 }
 
-void VirtualFileSystemImpl_MCRAW::init(FileRenderOptions options) {
-    Decoder decoder(mSrcPath);
-    auto frames = decoder.getFrames();
-    std::sort(frames.begin(), frames.end());
+void VirtualFileSystemImpl_MCRAW::init(FileRenderOptions options, int draftScale) {
+    std::lock_guard<std::mutex> lock(mMutex);
+
+    // Empty containers keep an empty state
+    mState = std::make_shared<const RenderState>(RenderState{ options, draftScale, 0, {}, {} });
+
+    auto decoder = mDecoderPool->acquire();
+    auto frames = decoder->getFrames();
 
     if(frames.empty())
         return;
 
-    spdlog::debug("VirtualFileSystemImpl_MCRAW::init(options={})", optionsToString(options));
+    // Frame index is the position in the container, look it up once here instead of on every read
+    std::unordered_map<Timestamp, int64_t> frameIndices;
+
+    frameIndices.reserve(frames.size());
 
-    // Clear everything
-    mFiles.clear();
+    for(size_t i = 0; i < frames.size(); ++i)
+        frameIndices.emplace(frames[i], static_cast<int64_t>(i));
+
+    std::sort(frames.begin(), frames.end());
+
+    spdlog::debug("VirtualFileSystemImpl_MCRAW::init(options={})", optionsToString(options));
 
     mFps = calculateFrameRate(frames);
 
-    // Calculate typical DNG size that we can use for all files
-    std::vector<uint8_t> data;
+    // Only the metadata of the first frame is needed to size the DNGs, its pixels are never decoded
     nlohmann::json metadata;
 
-    decoder.loadFrame(frames[0], data, metadata);
+    decoder->loadFrameMetadata(frames[0], metadata);
 
-    auto cameraConfig = CameraConfiguration::parse(decoder.getContainerMetadata());
-    auto cameraFrameMetadata = CameraFrameMetadata::parse(metadata);
+    // Container metadata is the same for every frame, parse it once and share it with the render tasks
+    auto cameraConfig = std::make_shared<const CameraConfiguration>(
+        CameraConfiguration::parse(decoder->getContainerMetadata()));
+
+    mCameraConfiguration = cameraConfig;
+
+    mFirstFrameMetadata = CameraFrameMetadata::parse(metadata);
     
     // Store frame information
-    mWidth = cameraFrameMetadata.width;
-    mHeight = cameraFrameMetadata.height;
+    mWidth = mFirstFrameMetadata.width;
+    mHeight = mFirstFrameMetadata.height;
     mTotalFrames = static_cast<int>(frames.size());
     mDroppedFrames = 0; // Will be calculated during frame processing
 
-    auto dngData = utils::generateDng(
-        data,
-        cameraFrameMetadata,
-        cameraConfig,
-        mFps,
-        0,
-        options,
-        getScaleFromOptions(options, mDraftScale));
-
-    mTypicalDngSize = dngData->size();
-
-    // Generate file entries
+    // Generate file entries, the DNG sizes are filled in with the layout
+    std::vector<Entry> files;
     int lastPts = 0;
 
-    mFiles.reserve(frames.size()*2);
+    files.reserve(frames.size()*2);
 
 // Disable icon previews in Windows/MacOS
 #ifdef _WIN32
@@ -261,39 +505,71 @@ void VirtualFileSystemImpl_MCRAW::init(FileRenderOptions options) {
     desktopIni.size = DESKTOP_INI.size();
     desktopIni.name = "desktop.ini";
 
-    mFiles.emplace_back(desktopIni);
+    files.emplace_back(desktopIni);
 #endif
 
-    // Generate and add audio (TODO: We're loading all the audio into memory)
+    // Only the header of audio.wav is kept, along with where each chunk lands in the samples, the samples are
+    // read when the file is. The container can only load all of the audio at once, so it is indexed from the disk
+    // cache when the audio is there and only loaded otherwise.
     Entry audioEntry;
 
+    mAudioHeader.clear();
+    mAudioChunkOffsets.clear();
+    mAudioDataSize = 0;
+
     std::vector<AudioChunk> audioChunks;
-    decoder.loadAudio(audioChunks);
+
+    if(!restoreAudioIndex())
+        decoder->loadAudio(audioChunks);
 
     if(!audioChunks.empty()) {
-        auto fpsFraction = utils::toFraction(mFps);
-        AudioWriter audioWriter(mAudioFile, decoder.numAudioChannels(), decoder.audioSampleRateHz(), fpsFraction.first, fpsFraction.second);
+        const int numChannels = decoder->numAudioChannels();
+        const int sampleRate = decoder->audioSampleRateHz();
 
         // Sync the audio to the video
-        syncAudio(
-            frames[0],
-            audioChunks,
-            decoder.audioSampleRateHz(),
-            decoder.numAudioChannels());
+        int64_t offset =
+            getAudioSyncOffset(frames[0], audioChunks[0].first, sampleRate, numChannels) * static_cast<int64_t>(sizeof(int16_t));
+
+        mAudioChunkOffsets.reserve(audioChunks.size() + 1);
+
+        for(auto& x : audioChunks) {
+            mAudioChunkOffsets.push_back(offset);
+
+            // Only whole audio frames are written
+            offset += static_cast<int64_t>((x.second.size() / numChannels) * numChannels * sizeof(int16_t));
+        }
+
+        mAudioChunkOffsets.push_back(offset);
+        mAudioDataSize = static_cast<uint64_t>((std::max)(offset, static_cast<int64_t>(0)));
+
+        auto fpsFraction = utils::toFraction(mFps);
+
+        mAudioHeader = AudioWriter::writeHeader(numChannels, sampleRate, fpsFraction.first, fpsFraction.second, mAudioDataSize);
 
-        for(auto& x : audioChunks)
-            audioWriter.write(x.second, x.second.size() / decoder.numAudioChannels());
+        // Later mounts and reads of the samples use the copy on disk instead of loading the container again. The
+        // chunks are handed over, so the mount doesn't hold a second copy of the samples or wait for the write.
+        if(mDiskCache.enabled()) {
+            auto chunks = std::make_shared<std::vector<AudioChunk>>(std::move(audioChunks));
+
+            storeAudioInBackground([this, chunks]() {
+                return renderAudioPages(*chunks, mAudioChunkOffsets, mAudioDataSize);
+            });
+        }
     }
 
-    if(!mAudioFile.empty()) {
+    if(!mAudioHeader.empty()) {
         audioEntry.type = EntryType::FILE_ENTRY;
-        audioEntry.size = mAudioFile.size();
+        audioEntry.size = mAudioHeader.size() + mAudioDataSize;
         audioEntry.name = "audio.wav";
 
-        mFiles.emplace_back(audioEntry);
+        files.emplace_back(audioEntry);
     }
 
-    // Add video frames
+    // Add video frames, read-ahead steps through them in order
+    std::vector<Entry> frameEntries;
+
+    frameEntries.reserve(frames.size());
+
     for(auto& x : frames) {
         int pts = getFrameNumberFromTimestamp(x, frames[0], mFps);
 
@@ -306,131 +582,647 @@ void VirtualFileSystemImpl_MCRAW::init(FileRenderOptions options) {
 
             // Add main entry
             entry.type = EntryType::FILE_ENTRY;
-            entry.size = mTypicalDngSize;
+            entry.size = 0;
             entry.name = constructFrameFilename("frame-", lastPts, 6, "dng");
-            entry.userData = x;
+            entry.userData = FrameReference{ x, frameIndices[x] };
 
-            mFiles.emplace_back(entry);
+            if(frameEntries.empty() || std::get<FrameReference>(frameEntries.back().userData).timestamp != x)
+                frameEntries.push_back(entry);
+
+            files.emplace_back(entry);
 
             ++lastPts;
         }
     }
+
+    buildFileIndex(files);
+
+    auto state = buildState(options, draftScale, std::move(files));
+
+    for(auto& entry : frameEntries)
+        entry.size = state->layout.fileSize();
+
+    {
+        std::lock_guard<std::mutex> stateLock(mStateLock);
+        mState = state;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mReadAheadLock);
+
+        mFrameEntries = std::move(frameEntries);
+
+        // Start over, keeping the count of prefetches still running
+        mReadAhead = ReadAheadState{ -1, 0, 0, 0, mReadAhead.inFlight, 0, 0, {} };
+        mLastReadTimestamp = -1;
+
+        ++mReadAheadEpoch;
+    }
+}
+
+std::shared_ptr<const VirtualFileSystemImpl_MCRAW::RenderState> VirtualFileSystemImpl_MCRAW::buildState(
+    FileRenderOptions options, int draftScale, std::vector<Entry> files)
+{
+    auto state = std::make_shared<RenderState>();
+
+    state->options = options;
+    state->draftScale = draftScale;
+
+    // Layout is the same for every frame, reads are mapped to the header and row bands with it. The size follows
+    // from the tags and the packed image size, so it is known without rendering anything.
+    state->layout = utils::getDngLayout(
+        mFirstFrameMetadata,
+        *mCameraConfiguration,
+        mFps,
+        options,
+        getScaleFromOptions(options, draftScale));
+
+    // Each set of options keeps its generation, so switching back to earlier options finds their segments cached
+    const auto generation = static_cast<uint32_t>(mGenerations.size());
+
+    state->generation = mGenerations.emplace(getRenderId(options, draftScale), generation).first->second;
+
+    // Frames, names and audio don't depend on the options, only the DNG sizes change
+    for(auto& entry : files) {
+        if(std::holds_alternative<FrameReference>(entry.userData))
+            entry.size = state->layout.fileSize();
+    }
+
+    state->files = std::move(files);
+
+    return state;
+}
+
+std::shared_ptr<const VirtualFileSystemImpl_MCRAW::RenderState> VirtualFileSystemImpl_MCRAW::getState() const {
+    std::lock_guard<std::mutex> lock(mStateLock);
+
+    return mState;
+}
+
+void VirtualFileSystemImpl_MCRAW::buildFileIndex(const std::vector<Entry>& files) {
+    // Keys are views into mFilePaths, so it must not be modified once the index is built
+    mFilePaths.reserve(files.size());
+
+    for(const auto& e : files)
+        mFilePaths.push_back(e.getFullPath().generic_string());
+
+    mFileIndex.reserve(mFilePaths.size());
+
+    for(size_t i = 0; i < mFilePaths.size(); ++i)
+        mFileIndex.emplace(mFilePaths[i], i);
 }
 
 std::vector<Entry> VirtualFileSystemImpl_MCRAW::listFiles(const std::string& filter) const {
     // TODO: Use filter
-    return mFiles;
+    return getState()->files;
 }
 
 std::optional<Entry> VirtualFileSystemImpl_MCRAW::findEntry(const std::string& fullPath) const {
-    for(const auto& e : mFiles) {
-        if(boost::filesystem::path(fullPath).relative_path() == e.getFullPath())
-            return e;
+    std::string_view path(fullPath);
+
+    // Paths are relative to the mount point
+    auto start = path.find_first_not_of("/\\");
+    if(start == std::string_view::npos)
+        return {};
+
+    path.remove_prefix(start);
+
+    auto it = mFileIndex.find(path);
+    if(it == mFileIndex.end())
+        return {};
+
+    return getState()->files[it->second];
+}
+
+std::shared_future<std::shared_ptr<const VirtualFileSystemImpl_MCRAW::DecodedFrame>>
+    VirtualFileSystemImpl_MCRAW::getDecodedFrame(const Entry& entry, TaskPriority priority)
+{
+    const auto frame = std::get<FrameReference>(entry.userData);
+
+    std::lock_guard<std::mutex> lock(mDecodedFramesLock);
+
+    for(auto it = mDecodedFrames.begin(); it != mDecodedFrames.end(); ++it) {
+        if(it->timestamp == frame.timestamp) {
+            mDecodedFrames.splice(mDecodedFrames.begin(), mDecodedFrames, it);
+
+            // A read needs a frame that is only queued for prefetching, so it doesn't wait behind the reads
+            auto& job = it->job;
+
+            if(priority < job->priority && !job->started) {
+                job->priority = priority;
+                submitDecode(frame.timestamp, job);
+            }
+
+            return it->result;
+        }
+    }
+
+    auto job = std::make_shared<DecodeJob>();
+
+    job->priority = priority;
+
+    auto result = job->promise.get_future().share();
+
+    submitDecode(frame.timestamp, job);
+
+    mDecodedFrames.push_front(PendingDecode{ frame.timestamp, result, job });
+
+    while(mDecodedFrames.size() > DECODED_FRAME_CACHE_SIZE)
+        mDecodedFrames.pop_back();
+
+    return result;
+}
+
+void VirtualFileSystemImpl_MCRAW::submitDecode(int64_t timestamp, const std::shared_ptr<DecodeJob>& job) {
+    // Use IO thread pool to decode frame
+    mIoThreadPool.submit(job->priority, [decoderPool = mDecoderPool, timestamp, job]() {
+        if(job->started.exchange(true))
+            return;
+
+        spdlog::debug("Reading frame {}", timestamp);
+
+        try {
+            auto decodedFrame = std::make_shared<DecodedFrame>();
+            nlohmann::json metadata;
+
+            decoderPool->acquire()->loadFrame(timestamp, decodedFrame->data, metadata);
+
+            decodedFrame->metadata = CameraFrameMetadata::parse(metadata);
+
+            job->promise.set_value(std::move(decodedFrame));
+        }
+        catch(...) {
+            job->promise.set_exception(std::current_exception());
+        }
+    });
+}
+
+VirtualFileSystemImpl_MCRAW::FrameRequest VirtualFileSystemImpl_MCRAW::makeFrameRequest(
+    const RenderState& state, const Entry& entry) const
+{
+    const auto& frame = std::get<FrameReference>(entry.userData);
+
+    // Dropped frames are filled with duplicate entries, those share their cache segments through the frame index
+    return FrameRequest{
+        entry,
+        CacheKey{ mMountId, state.generation, frame.frameIndex, 0 },
+        DiskCacheKey{ mSourceId, getRenderId(state.options, state.draftScale), frame.frameIndex },
+        state.layout,
+        mCameraConfiguration,
+        mFps,
+        state.options,
+        getScaleFromOptions(state.options, state.draftScale)
+    };
+}
+
+bool VirtualFileSystemImpl_MCRAW::loadSegments(
+    const FrameRequest& request,
+    int64_t firstSegment,
+    int64_t lastSegment,
+    TaskPriority priority,
+    const std::function<void(int64_t, const char*, size_t)>& consume)
+{
+    const auto& frame = std::get<FrameReference>(request.entry.userData);
+    const auto& layout = request.layout;
+
+    bool rendered = false;
+    bool diskChecked = false;
+    std::shared_ptr<const DiskCacheFrame> diskFrame;
+    std::shared_future<std::shared_ptr<const DecodedFrame>> decodedFrameFuture;
+
+    for(auto segment = firstSegment; segment <= lastSegment; ++segment) {
+        CacheKey key{ request.cacheKey.mountId, request.cacheKey.generation, request.cacheKey.frameIndex, segment };
+
+        // Either claims the segment or waits for the thread already rendering it
+        auto data = mCache.get(key);
+
+        if(!data) try {
+            if(!diskChecked) {
+                diskFrame = getDiskFrame(request);
+                diskChecked = true;
+            }
+
+            // Frames on disk are read straight from the mapping and not copied into memory, the page cache already
+            // holds them. Readers waiting on the claim read the mapping too.
+            if(diskFrame) {
+                mCache.markLoadFailed(key);
+
+                consume(segment, diskFrame->segmentData(segment), diskFrame->segmentSize(segment));
+                continue;
+            }
+
+            // The frame is only decoded if it isn't on disk either
+            if(!decodedFrameFuture.valid())
+                decodedFrameFuture = getDecodedFrame(request.entry, priority);
+
+            auto decodedFrame = decodedFrameFuture.get();
+
+            spdlog::debug("Generating {} segment {}", request.entry.name, segment);
+
+            if(segment == 0) {
+                data = utils::generateDngHeader(
+                    decodedFrame->metadata,
+                    *request.cameraConfiguration,
+                    request.fps,
+                    static_cast<int>(frame.frameIndex),
+                    request.options,
+                    request.scale);
+
+                if(data->size() != layout.headerSize)
+                    throw std::runtime_error("Frame header does not match the layout of the recording");
+            }
+            else {
+                data = renderPage(
+                    layout,
+                    segment,
+                    decodedFrame->data,
+                    decodedFrame->metadata,
+                    *request.cameraConfiguration,
+                    request.options,
+                    request.scale);
+            }
+
+            rendered = true;
+
+            mCache.put(key, data);
+        }
+        catch(...) {
+            mCache.markLoadFailed(key);
+            throw;
+        }
+
+        consume(segment, data->data(), data->size());
+    }
+
+    return rendered;
+}
+
+std::shared_ptr<const DiskCacheFrame> VirtualFileSystemImpl_MCRAW::getDiskFrame(const FrameRequest& request) {
+    auto diskFrame = mDiskCache.get(request.diskCacheKey);
+
+    if(diskFrame && !matchesLayout(*diskFrame, request.layout)) {
+        spdlog::warn("Ignoring {} on disk, it does not match the layout of the recording", request.entry.name);
+        return nullptr;
+    }
+
+    return diskFrame;
+}
+
+void VirtualFileSystemImpl_MCRAW::storeFrame(const FrameRequest& request) {
+    if(!mDiskCache.enabled())
+        return;
+
+    const auto lastSegment = getSegment(request.layout, request.layout.fileSize() - 1);
+
+    std::vector<std::shared_ptr<std::vector<char>>> segments;
+
+    segments.reserve(lastSegment + 1);
+
+    // Frames that were only partly read aren't stored. Looking at the segments doesn't count as reading them, or
+    // every stored frame would look recently used to the cache.
+    for(int64_t segment = 0; segment <= lastSegment; ++segment) {
+        auto data = mCache.inspect(
+            CacheKey{ request.cacheKey.mountId, request.cacheKey.generation, request.cacheKey.frameIndex, segment });
+
+        if(!data)
+            return;
+
+        segments.push_back(std::move(data));
     }
 
-    return {};
+    mDiskCache.put(request.diskCacheKey, segments);
+}
+
+void VirtualFileSystemImpl_MCRAW::storeFrameInBackground(const FrameRequest& request) {
+    // Readers of the last segments of a frame finish at about the same time, only one of them stores it
+    if(!beginDiskWrite(request.diskCacheKey))
+        return;
+
+    mIoThreadPool.submit(
+        TASK_PRIORITY_PREFETCH,
+        [this, request]() {
+            storeFrame(request);
+            finishDiskWrite(request.diskCacheKey);
+        },
+        [this]() { return mStopping.load(); },
+        [this, key = request.diskCacheKey]() { finishDiskWrite(key); });
+}
+
+bool VirtualFileSystemImpl_MCRAW::beginDiskWrite(const DiskCacheKey& key) {
+    // Counted before the read is answered, the file system can be unmounted as soon as it is
+    std::lock_guard<std::mutex> lock(mReadAheadLock);
+
+    return mDiskWrites.insert(key.hash()).second;
+}
+
+void VirtualFileSystemImpl_MCRAW::finishDiskWrite(const DiskCacheKey& key) {
+    std::lock_guard<std::mutex> lock(mReadAheadLock);
+
+    mDiskWrites.erase(key.hash());
+    mReadAheadDone.notify_all();
 }
 
-size_t VirtualFileSystemImpl_MCRAW::generateFrame(
+int VirtualFileSystemImpl_MCRAW::generateFrame(
     const Entry& entry,
     const size_t pos,
     const size_t len,
     void* dst,
     std::function<void(size_t, int)> result,
-    bool async)
+    bool async,
+    std::function<bool()> isCancelled)
 {
-    using FrameData = std::tuple<size_t, CameraConfiguration, CameraFrameMetadata, std::shared_ptr<std::vector<uint8_t>>>;
+    // The whole read uses one set of options, even if they change while it is queued
+    const auto state = getState();
+    const auto& layout = state->layout;
+    const size_t fileSize = layout.fileSize();
+
+    if(pos >= fileSize)
+        return 0;
+
+    const size_t readLen = (std::min)(len, fileSize - pos);
+
+    // Header probes from file managers and metadata tools don't count as sequential reading, they would start
+    // decoding whole frames for read-ahead
+    if(pos + readLen <= layout.headerSize)
+        return generateFrameHeader(makeFrameRequest(*state, entry), pos, readLen, dst, result, async, isCancelled);
+
+    trackRead(entry);
+
+    const auto& frame = std::get<FrameReference>(entry.userData);
 
-    // Try to get from cache first
-    auto cacheEntry = mCache.get(entry);
-    if(cacheEntry && pos < cacheEntry->size()) {
-        // Calculate length to copy
-        const size_t actualLen = (std::min)(len, cacheEntry->size() - pos);
+    const int64_t firstSegment = getSegment(layout, pos);
+    const int64_t lastSegment = getSegment(layout, pos + readLen - 1);
 
-        // Copy the data from cache
-        std::memcpy(dst, cacheEntry->data() + pos, actualLen);
+    // Try to serve the whole read from the cache first
+    std::vector<std::shared_ptr<std::vector<char>>> segments;
 
-        // Push entry to front
-        mCache.put(entry, cacheEntry);
+    for(auto segment = firstSegment; segment <= lastSegment; ++segment) {
+        auto data = mCache.peek(CacheKey{ mMountId, state->generation, frame.frameIndex, segment });
+        if(!data)
+            break;
 
-        return actualLen;
+        segments.push_back(std::move(data));
     }
 
-    // Use IO thread pool to decode frame
-    auto frameDataFuture = mIoThreadPool.submit_task([entry, &srcPath = mSrcPath, &options = mOptions]() -> FrameData {
-        thread_local std::map<std::string, std::unique_ptr<Decoder>> decoders;
+    if(segments.size() == static_cast<size_t>(lastSegment - firstSegment + 1)) {
+        for(auto segment = firstSegment; segment <= lastSegment; ++segment) {
+            const auto& data = *segments[segment - firstSegment];
+
+            copySegment(layout, segment, data.data(), data.size(), pos, readLen, dst);
+        }
+
+        return readLen;
+    }
+
+    // Only the segments covering the read are rendered
+    auto generateTask = [this, request = makeFrameRequest(*state, entry), firstSegment, lastSegment, pos, readLen, dst, result]() {
+        size_t readBytes = 0;
+        int errorCode = -EIO;
+
+        try {
+            auto copy = [&](int64_t segment, const char* data, size_t size) {
+                copySegment(request.layout, segment, data, size, pos, readLen, dst);
+            };
+
+            const bool rendered = loadSegments(request, firstSegment, lastSegment, TASK_PRIORITY_FOREGROUND, copy);
+
+            // Written on another task so the read doesn't wait on the disk, nothing may use this instance once the
+            // result is sent
+            if(rendered)
+                storeFrameInBackground(request);
+
+            readBytes = readLen;
+            errorCode = 0;
+        }
+        catch(std::exception& e) {
+            spdlog::error("Failed to generate DNG (error: {})", e.what());
+        }
+
+        result(readBytes, errorCode);
+
+        return readBytes;
+    };
+
+    // Use processing thread pool to generate DNG
+    return scheduleRead(mProcessingThreadPool, generateTask, result, isCancelled, async);
+}
+
+void VirtualFileSystemImpl_MCRAW::trackRead(const Entry& entry) {
+    const auto& frame = std::get<FrameReference>(entry.userData);
+
+    // Frames are read in many small reads, only moving to another frame matters
+    if(frame.timestamp == mLastReadTimestamp.load(std::memory_order_relaxed))
+        return;
+
+    std::vector<Entry> prefetch;
+    uint64_t epoch = 0;
+
+    {
+        std::lock_guard<std::mutex> lock(mReadAheadLock);
+
+        if(frame.timestamp == mLastReadTimestamp.load(std::memory_order_relaxed))
+            return;
+
+        mLastReadTimestamp.store(frame.timestamp, std::memory_order_relaxed);
+
+        auto it = std::lower_bound(
+            mFrameEntries.begin(), mFrameEntries.end(), frame.timestamp,
+            [](const Entry& e, int64_t timestamp) { return std::get<FrameReference>(e.userData).timestamp < timestamp; });
+
+        if(it == mFrameEntries.end())
+            return;
+
+        const auto position = static_cast<int64_t>(it - mFrameEntries.begin());
+        const auto step = position - mReadAhead.position;
+        const auto now = std::chrono::steady_clock::now();
+
+        if(mReadAhead.position >= 0 && (step == 1 || step == -1)) {
+            if(step == mReadAhead.direction) {
+                ++mReadAhead.sequentialReads;
+            }
+            else {
+                mReadAhead.direction = static_cast<int>(step);
+                mReadAhead.sequentialReads = 1;
+                mReadAhead.next = position + step;
+
+                ++mReadAheadEpoch;
+            }
+
+            // How fast the reader consumes frames
+            const double intervalMs = std::chrono::duration<double, std::milli>(now - mReadAhead.lastReadTime).count();
+
+            mReadAhead.frameIntervalMs = mReadAhead.frameIntervalMs > 0 ?
+                mReadAhead.frameIntervalMs + (intervalMs - mReadAhead.frameIntervalMs) * READ_AHEAD_SMOOTHING : intervalMs;
+        }
+        else {
+            mReadAhead.direction = 0;
+            mReadAhead.sequentialReads = 0;
+
+            ++mReadAheadEpoch;
+        }
+
+        mReadAhead.position = position;
+        mReadAhead.lastReadTime = now;
+
+        if(mReadAhead.sequentialReads < READ_AHEAD_MIN_SEQUENTIAL_READS)
+            return;
 
-        auto timestamp = std::get<Timestamp>(entry.userData);
+        // Don't go back over frames the reader has already passed
+        if((mReadAhead.next - position) * mReadAhead.direction <= 0)
+            mReadAhead.next = position + mReadAhead.direction;
 
-        spdlog::debug("Reading frame {} with options {}", timestamp, optionsToString(options));
+        const int64_t depth = getReadAheadDepth();
+        const int64_t end = position + mReadAhead.direction * (depth + 1);
 
-        if(decoders.find(srcPath) == decoders.end()) {
-            decoders[srcPath] = std::make_unique<Decoder>(srcPath);
+        int available = static_cast<int>(depth) - mReadAhead.inFlight;
+
+        while(available > 0 && (end - mReadAhead.next) * mReadAhead.direction > 0 && mReadAhead.next >= 0 &&
+              mReadAhead.next < static_cast<int64_t>(mFrameEntries.size()))
+        {
+            prefetch.push_back(mFrameEntries[mReadAhead.next]);
+
+            mReadAhead.next += mReadAhead.direction;
+            ++mReadAhead.inFlight;
+            --available;
         }
 
-        auto& decoder = decoders[srcPath];
-        auto data = std::make_shared<std::vector<uint8_t>>();
+        epoch = mReadAheadEpoch;
+    }
+
+    for(const auto& prefetchEntry : prefetch)
+        prefetchFrame(prefetchEntry, epoch);
+}
+
+int64_t VirtualFileSystemImpl_MCRAW::getReadAheadDepth() const {
+    const auto fileSize = (std::max)(getState()->layout.fileSize(), static_cast<size_t>(1));
+
+    // Enough frames in flight to hide the render time at the rate the reader consumes them
+    int64_t depth = READ_AHEAD_DEFAULT_DEPTH;
+
+    if(mReadAhead.renderTimeMs > 0 && mReadAhead.frameIntervalMs > 0)
+        depth = static_cast<int64_t>(std::ceil(mReadAhead.renderTimeMs / mReadAhead.frameIntervalMs)) + 1;
+
+    // More renders than threads just queue up
+    depth = (std::min)(depth, static_cast<int64_t>(mProcessingThreadPool.getThreadCount()));
+
+    // Prefetched frames have to survive in the cache until they are read
+    depth = (std::min)(depth, static_cast<int64_t>(mCache.capacity() / READ_AHEAD_CACHE_FRACTION / fileSize));
+
+    return std::clamp(depth, static_cast<int64_t>(0), static_cast<int64_t>(READ_AHEAD_MAX_DEPTH));
+}
+
+void VirtualFileSystemImpl_MCRAW::prefetchFrame(const Entry& entry, uint64_t epoch) {
+    auto prefetchTask = [this, request = makeFrameRequest(*getState(), entry)]() {
+        const auto start = std::chrono::steady_clock::now();
+        const auto lastSegment = getSegment(request.layout, request.layout.fileSize() - 1);
+
+        bool rendered = false;
 
-        nlohmann::json metadata;
-        auto allFrames = decoder->getFrames();
+        try {
+            rendered = loadSegments(request, 0, lastSegment, TASK_PRIORITY_PREFETCH, [](int64_t, const char*, size_t) {});
 
-        // Find the frame (index)
-        auto it = std::find(allFrames.begin(), allFrames.end(), timestamp);
-        if(it == allFrames.end()) {
-            spdlog::error("Frame {} not found", timestamp);
-            throw std::runtime_error("Failed to find frame");
+            if(rendered)
+                storeFrame(request);
+        }
+        catch(std::exception& e) {
+            spdlog::warn("Failed to prefetch {} (error: {})", request.entry.name, e.what());
         }
 
-        decoder->loadFrame(timestamp, *data, metadata);
+        // Frames that were already cached say nothing about the render time
+        finishPrefetch(!rendered ? 0 : std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+    };
 
-        size_t frameIndex = std::distance(allFrames.begin(), it);
+    // Prefetches for an access pattern the reader has given up on are dropped
+    mProcessingThreadPool.submit(
+        TASK_PRIORITY_PREFETCH,
+        prefetchTask,
+        [this, epoch]() { return mStopping || mReadAheadEpoch != epoch; },
+        [this]() { finishPrefetch(0); });
+}
 
-        return std::make_tuple(
-            frameIndex, CameraConfiguration::parse(decoder->getContainerMetadata()), CameraFrameMetadata::parse(metadata), std::move(data));
-    });
+void VirtualFileSystemImpl_MCRAW::finishPrefetch(double renderTimeMs) {
+    std::lock_guard<std::mutex> lock(mReadAheadLock);
 
+    if(renderTimeMs > 0) {
+        mReadAhead.renderTimeMs = mReadAhead.renderTimeMs > 0 ?
+            mReadAhead.renderTimeMs + (renderTimeMs - mReadAhead.renderTimeMs) * READ_AHEAD_SMOOTHING : renderTimeMs;
+    }
 
-    // Use processing thread pool to generate DNG
-    auto sharableFuture = frameDataFuture.share();
+    --mReadAhead.inFlight;
+    mReadAheadDone.notify_all();
+}
+
+int VirtualFileSystemImpl_MCRAW::generateFrameHeader(
+    const FrameRequest& request,
+    const size_t pos,
+    const size_t len,
+    void* dst,
+    std::function<void(size_t, int)> result,
+    bool async,
+    std::function<bool()> isCancelled)
+{
+    // The header is segment 0 of the frame, shared with reads that render the whole file
+    auto copyHeader = [pos, len, dst](const std::vector<char>& header) -> size_t {
+        if(pos >= header.size())
+            return 0;
 
-    const auto fps = mFps;
-    const auto draftScale = mDraftScale;
+        const size_t readBytes = (std::min)(len, header.size() - pos);
 
-    auto generateTask = [&options = mOptions, &cache = mCache, entry, sharableFuture, fps, draftScale, pos, len, dst, result]() {
+        std::memcpy(dst, header.data() + pos, readBytes);
+
+        return readBytes;
+    };
+
+    if(auto header = mCache.peek(request.cacheKey))
+        return static_cast<int>(copyHeader(*header));
+
+    // Only the frame metadata is read, the pixels are never decoded. The header isn't claimed in the cache, whoever
+    // holds the claim may be waiting on a decode queued behind this task on the IO pool. Headers are small and the
+    // same for every render, so two threads producing one at once is harmless.
+    auto headerTask = [&cache = mCache, &diskCache = mDiskCache, decoderPool = mDecoderPool, request, copyHeader, result]() {
         size_t readBytes = 0;
-        int errorCode = -1;
+        int errorCode = -EIO;
 
         try {
-            auto decodedFrame = sharableFuture.get();
-            auto [frameIndex, containerMetadata, frameMetadata, frameData] = std::move(decodedFrame);
+            auto header = cache.peek(request.cacheKey);
+
+            if(!header) {
+                // Headers are small, the one on disk is copied so it can be cached with the other segments
+                auto diskFrame = diskCache.get(request.diskCacheKey);
 
-            spdlog::debug("Generating {}", entry.name);
+                if(diskFrame && matchesLayout(*diskFrame, request.layout)) {
+                    const char* data = diskFrame->segmentData(0);
 
-            auto dngData = utils::generateDng(
-                *frameData,
-                frameMetadata,
-                containerMetadata,
-                fps,
-                frameIndex,
-                options,
-                getScaleFromOptions(options, draftScale));
+                    header = std::make_shared<std::vector<char>>(data, data + diskFrame->segmentSize(0));
+                }
+
+                if(!header) {
+                    const auto& frame = std::get<FrameReference>(request.entry.userData);
 
-            if(dngData && pos < dngData->size()) {
-                // Calculate length to copy
-                const size_t actualLen = (std::min)(len, dngData->size() - pos);
+                    nlohmann::json metadata;
 
-                std::memcpy(dst, dngData->data() + pos, actualLen);
+                    decoderPool->acquire()->loadFrameMetadata(frame.timestamp, metadata);
 
-                readBytes = actualLen;
-                errorCode = 0;
+                    header = utils::generateDngHeader(
+                        CameraFrameMetadata::parse(metadata),
+                        *request.cameraConfiguration,
+                        request.fps,
+                        static_cast<int>(frame.frameIndex),
+                        request.options,
+                        request.scale);
+
+                    if(header->size() != request.layout.headerSize)
+                        throw std::runtime_error("Frame header does not match the layout of the recording");
+                }
+
+                cache.put(request.cacheKey, header);
             }
 
-            // Add to cache
-            cache.put(entry, dngData);
+            readBytes = copyHeader(*header);
+            errorCode = 0;
         }
-        catch(std::runtime_error& e) {
-            spdlog::error("Failed to generate DNG (error: {})", e.what());
-            cache.markLoadFailed(entry);
+        catch(std::exception& e) {
+            spdlog::error("Failed to generate DNG header (error: {})", e.what());
         }
 
         result(readBytes, errorCode);
@@ -438,35 +1230,240 @@ size_t VirtualFileSystemImpl_MCRAW::generateFrame(
         return readBytes;
     };
 
+    return scheduleRead(mIoThreadPool, headerTask, result, isCancelled, async);
+}
+
+bool VirtualFileSystemImpl_MCRAW::restoreAudioIndex() {
+    auto audio = mDiskCache.get(getAudioDiskKey(mSourceId));
+    if(!audio)
+        return false;
+
+    const auto dataSize = getDiskAudioDataSize(*audio);
+
+    if(dataSize < 0) {
+        spdlog::warn("Ignoring audio of {} on disk, it does not add up", mSrcPath);
+        return false;
+    }
+
+    const auto* offsets = audio->segmentData(AUDIO_OFFSETS_SEGMENT);
+    const auto* header = reinterpret_cast<const uint8_t*>(audio->segmentData(AUDIO_HEADER_SEGMENT));
+
+    mAudioChunkOffsets.resize(audio->segmentSize(AUDIO_OFFSETS_SEGMENT) / sizeof(int64_t));
+    std::memcpy(mAudioChunkOffsets.data(), offsets, audio->segmentSize(AUDIO_OFFSETS_SEGMENT));
+
+    mAudioHeader.assign(header, header + audio->segmentSize(AUDIO_HEADER_SEGMENT));
+    mAudioDataSize = static_cast<uint64_t>(dataSize);
+
+    return true;
+}
+
+std::shared_ptr<const DiskCacheFrame> VirtualFileSystemImpl_MCRAW::getDiskAudio() {
+    auto audio = mDiskCache.get(getAudioDiskKey(mSourceId));
+
+    if(audio &&
+       (getDiskAudioDataSize(*audio) != static_cast<int64_t>(mAudioDataSize) ||
+        audio->segmentSize(AUDIO_OFFSETS_SEGMENT) != mAudioChunkOffsets.size() * sizeof(int64_t)))
+    {
+        spdlog::warn("Ignoring audio of {} on disk, it does not match the index", mSrcPath);
+        return nullptr;
+    }
+
+    return audio;
+}
+
+void VirtualFileSystemImpl_MCRAW::storeAudioInBackground(
+    std::function<std::vector<std::shared_ptr<std::vector<char>>>()> renderPages)
+{
+    if(!beginDiskWrite(getAudioDiskKey(mSourceId)))
+        return;
+
+    mIoThreadPool.submit(
+        TASK_PRIORITY_PREFETCH,
+        [this, renderPages = std::move(renderPages)]() {
+            try {
+                const auto* offsets = reinterpret_cast<const char*>(mAudioChunkOffsets.data());
+                const auto* header = reinterpret_cast<const char*>(mAudioHeader.data());
+
+                auto pages = renderPages();
+
+                std::vector<std::shared_ptr<std::vector<char>>> segments;
+
+                segments.reserve(AUDIO_FIRST_PAGE_SEGMENT + pages.size());
+                segments.push_back(std::make_shared<std::vector<char>>(offsets, offsets + mAudioChunkOffsets.size() * sizeof(int64_t)));
+                segments.push_back(std::make_shared<std::vector<char>>(header, header + mAudioHeader.size()));
+                segments.insert(segments.end(), pages.begin(), pages.end());
+
+                pages.clear();
+
+                mDiskCache.put(getAudioDiskKey(mSourceId), segments);
+            }
+            catch(std::exception& e) {
+                spdlog::error("Failed to store audio of {} (error: {})", mSrcPath, e.what());
+            }
+
+            finishDiskWrite(getAudioDiskKey(mSourceId));
+        },
+        [this]() { return mStopping.load(); },
+        [this]() { finishDiskWrite(getAudioDiskKey(mSourceId)); });
+}
+
+void VirtualFileSystemImpl_MCRAW::loadAudioPages(
+    int64_t firstPage,
+    int64_t lastPage,
+    const std::function<void(int64_t, const std::vector<char>&)>& consume)
+{
+    // Pages are copied out of the audio on disk. Without it the container has to load all of the audio at once,
+    // that happens at most once per call.
+    std::shared_ptr<const DiskCacheFrame> diskAudio;
+    std::vector<AudioChunk> audioChunks;
+    bool checkedDisk = false;
+    bool loaded = false;
+
+    auto loadPage = [&](int64_t page) {
+        if(!checkedDisk) {
+            diskAudio = getDiskAudio();
+            checkedDisk = true;
+        }
+
+        if(diskAudio) {
+            const auto segment = AUDIO_FIRST_PAGE_SEGMENT + static_cast<size_t>(page);
+            const char* data = diskAudio->segmentData(segment);
+
+            return std::make_shared<std::vector<char>>(data, data + diskAudio->segmentSize(segment));
+        }
+
+        if(!loaded) {
+            spdlog::debug("Loading audio from {}", mSrcPath);
+
+            mDecoderPool->acquire()->loadAudio(audioChunks);
+            loaded = true;
+        }
+
+        return renderAudioPage(audioChunks, mAudioChunkOffsets, mAudioDataSize, page);
+    };
+
+    for(auto page = firstPage; page <= lastPage; ++page) {
+        const CacheKey key{ mMountId, 0, AUDIO_FRAME_INDEX, page };
 
-    auto processFuture = mProcessingThreadPool.submit_task(generateTask);
-    if(!async)
-        return processFuture.get();
+        auto data = mCache.get(key);
 
-    return 0;
+        if(!data) {
+            try {
+                data = loadPage(page);
+            }
+            catch(...) {
+                mCache.markLoadFailed(key);
+                throw;
+            }
+
+            mCache.put(key, data);
+        }
+
+        consume(page, *data);
+    }
+
+    if(!loaded)
+        return;
+
+    // Keep the pages that come next so a sequential reader doesn't load all the audio again for each read
+    const auto lastAudioPage = getAudioPageCount(mAudioDataSize) - 1;
+
+    for(auto page = lastPage + 1; page <= (std::min)(lastPage + AUDIO_READ_AHEAD_PAGES, lastAudioPage); ++page) {
+        const CacheKey key{ mMountId, 0, AUDIO_FRAME_INDEX, page };
+
+        if(!mCache.inspect(key))
+            mCache.put(key, renderAudioPage(audioChunks, mAudioChunkOffsets, mAudioDataSize, page));
+    }
+
+    // The disk cache was off at mount or has evicted the audio since. It is stored again unless a write is already
+    // under way, the rest of the pages are rendered by that write and not here.
+    if(mDiskCache.enabled()) {
+        auto chunks = std::make_shared<std::vector<AudioChunk>>(std::move(audioChunks));
+
+        storeAudioInBackground([this, chunks]() {
+            return renderAudioPages(*chunks, mAudioChunkOffsets, mAudioDataSize);
+        });
+    }
 }
 
-size_t VirtualFileSystemImpl_MCRAW::generateAudio(
+int VirtualFileSystemImpl_MCRAW::generateAudio(
     const Entry& entry,
     const size_t pos,
     const size_t len,
     void* dst,
     std::function<void(size_t, int)> result,
-    bool async)
+    bool async,
+    std::function<bool()> isCancelled)
 {
-    size_t readBytes = 0;
+    const size_t headerSize = mAudioHeader.size();
+    const size_t fileSize = headerSize + mAudioDataSize;
+
+    if(pos >= fileSize)
+        return 0;
+
+    const size_t readLen = (std::min)(len, fileSize - pos);
+
+    // Header is always in memory
+    size_t headerBytes = 0;
+
+    if(pos < headerSize) {
+        headerBytes = (std::min)(readLen, headerSize - pos);
+
+        std::memcpy(dst, mAudioHeader.data() + pos, headerBytes);
+    }
 
-    if(pos < mAudioFile.size()) {
-        // Calculate length to copy
-        const size_t actualLen = (std::min)(len, mAudioFile.size() - pos);
+    if(headerBytes == readLen)
+        return readLen;
 
-        std::memcpy(dst, mAudioFile.data() + pos, actualLen);
+    // Rest of the read is in the samples
+    const uint64_t dataPos = pos + headerBytes - headerSize;
+    const size_t dataLen = readLen - headerBytes;
+    void* dataDst = static_cast<char*>(dst) + headerBytes;
 
-        readBytes = actualLen;
+    const auto firstPage = static_cast<int64_t>(dataPos / AUDIO_PAGE_SIZE);
+    const auto lastPage = static_cast<int64_t>((dataPos + dataLen - 1) / AUDIO_PAGE_SIZE);
+
+    // Try to serve the whole read from the cache first
+    std::vector<std::shared_ptr<std::vector<char>>> pages;
+
+    for(auto page = firstPage; page <= lastPage; ++page) {
+        auto data = mCache.peek(CacheKey{ mMountId, 0, AUDIO_FRAME_INDEX, page });
+        if(!data)
+            break;
+
+        pages.push_back(std::move(data));
     }
 
-    // Always read synchronously for now
-    return readBytes;
+    if(pages.size() == static_cast<size_t>(lastPage - firstPage + 1)) {
+        for(auto page = firstPage; page <= lastPage; ++page)
+            copyAudioPage(page, *pages[page - firstPage], dataPos, dataLen, dataDst);
+
+        return readLen;
+    }
+
+    auto audioTask = [this, firstPage, lastPage, dataPos, dataLen, dataDst, readLen, result]() {
+        size_t readBytes = 0;
+        int errorCode = -1;
+
+        try {
+            loadAudioPages(firstPage, lastPage, [&](int64_t page, const std::vector<char>& data) {
+                copyAudioPage(page, data, dataPos, dataLen, dataDst);
+            });
+
+            readBytes = readLen;
+            errorCode = 0;
+        }
+        catch(std::exception& e) {
+            spdlog::error("Failed to load audio (error: {})", e.what());
+        }
+
+        result(readBytes, errorCode);
+
+        return readBytes;
+    };
+
+    // Loading audio reads the container, use the IO thread pool
+    return scheduleRead(mIoThreadPool, audioTask, result, isCancelled, async);
 }
 
 int VirtualFileSystemImpl_MCRAW::readFile(
@@ -475,7 +1472,8 @@ int VirtualFileSystemImpl_MCRAW::readFile(
     const size_t len,
     void* dst,
     std::function<void(size_t, int)> result,
-    bool async) {
+    bool async,
+    std::function<bool()> isCancelled) {
 
     #ifdef _WIN32
         if(entry.name == "desktop.ini") {
@@ -488,20 +1486,53 @@ int VirtualFileSystemImpl_MCRAW::readFile(
 
     // Requestion audio?
     if(boost::ends_with(entry.name, "wav")) {
-        return generateAudio(entry, pos, len, dst, result, async);
+        return generateAudio(entry, pos, len, dst, result, async, isCancelled);
     }
     else if(boost::ends_with(entry.name, "dng")) {
-        return generateFrame(entry, pos, len, dst, result, async);
+        return generateFrame(entry, pos, len, dst, result, async, isCancelled);
     }
 
     return -1;
 }
 
 void VirtualFileSystemImpl_MCRAW::updateOptions(FileRenderOptions options, int draftScale) {
-    mDraftScale = draftScale;
-    mOptions = options;
+    std::lock_guard<std::mutex> lock(mMutex);
+
+    const auto current = getState();
+
+    if(options == current->options && draftScale == current->draftScale)
+        return;
+
+    spdlog::debug("VirtualFileSystemImpl_MCRAW::updateOptions(options={}, draftScale={})",
+                  optionsToString(options), draftScale);
+
+    // Empty container, there are no frames to resize
+    if(!mCameraConfiguration) {
+        auto state = std::make_shared<const RenderState>(RenderState{ options, draftScale, 0, {}, current->files });
+
+        std::lock_guard<std::mutex> stateLock(mStateLock);
+        mState = std::move(state);
+
+        return;
+    }
+
+    auto state = buildState(options, draftScale, current->files);
+
+    {
+        std::lock_guard<std::mutex> stateLock(mStateLock);
+        mState = state;
+    }
+
+    std::lock_guard<std::mutex> readAheadLock(mReadAheadLock);
+
+    for(auto& entry : mFrameEntries)
+        entry.size = state->layout.fileSize();
+
+    // Queued prefetches would render with the old options
+    mReadAhead = ReadAheadState{ -1, 0, 0, 0, mReadAhead.inFlight, 0, 0, {} };
+    mLastReadTimestamp = -1;
 
-    init(options);
+    ++mReadAheadEpoch;
 }
 
 FileInfo VirtualFileSystemImpl_MCRAW::getFileInfo() const {
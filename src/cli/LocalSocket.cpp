@@ -0,0 +1,235 @@
+#include "cli/LocalSocket.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+
+#ifdef _WIN32
+    #include <winsock2.h>
+    #include <afunix.h>
+#else
+    #include <poll.h>
+    #include <sys/socket.h>
+    #include <sys/un.h>
+    #include <unistd.h>
+#endif
+
+namespace motioncam {
+
+namespace {
+#ifdef _WIN32
+    constexpr SocketHandle INVALID_HANDLE = INVALID_SOCKET;
+
+    void closeHandle(SocketHandle handle) {
+        closesocket(handle);
+    }
+
+    int pollHandle(SocketHandle handle, int timeoutMs) {
+        WSAPOLLFD fd{};
+
+        fd.fd = handle;
+        fd.events = POLLRDNORM;
+
+        return WSAPoll(&fd, 1, timeoutMs);
+    }
+
+    void initSockets() {
+        static std::once_flag once;
+
+        std::call_once(once, [] {
+            WSADATA data;
+
+            if(WSAStartup(MAKEWORD(2, 2), &data) != 0)
+                throw std::runtime_error("Failed to initialise sockets");
+        });
+    }
+#else
+    constexpr SocketHandle INVALID_HANDLE = -1;
+
+    void closeHandle(SocketHandle handle) {
+        ::close(handle);
+    }
+
+    int pollHandle(SocketHandle handle, int timeoutMs) {
+        struct pollfd fd{};
+
+        fd.fd = handle;
+        fd.events = POLLIN;
+
+        return poll(&fd, 1, timeoutMs);
+    }
+
+    void initSockets() {
+    }
+#endif
+
+    sockaddr_un getAddress(const std::string& path) {
+        sockaddr_un address{};
+
+        if(path.size() >= sizeof(address.sun_path))
+            throw std::runtime_error("Socket path too long: " + path);
+
+        address.sun_family = AF_UNIX;
+        std::memcpy(address.sun_path, path.c_str(), path.size());
+
+        return address;
+    }
+
+    SocketHandle createSocket() {
+        initSockets();
+
+        auto handle = static_cast<SocketHandle>(socket(AF_UNIX, SOCK_STREAM, 0));
+        if(handle == INVALID_HANDLE)
+            throw std::runtime_error("Failed to create socket");
+
+        return handle;
+    }
+
+    bool connectSocket(SocketHandle handle, const std::string& path) {
+        const auto address = getAddress(path);
+
+        return ::connect(handle, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) == 0;
+    }
+}
+
+LocalSocket::LocalSocket(SocketHandle handle, const std::string& path) : mHandle(handle), mPath(path) {
+}
+
+LocalSocket::LocalSocket(LocalSocket&& other) noexcept :
+    mHandle(other.mHandle),
+    mPath(std::move(other.mPath)),
+    mBuffer(std::move(other.mBuffer))
+{
+    other.mHandle = INVALID_HANDLE;
+    other.mPath.clear();
+}
+
+LocalSocket& LocalSocket::operator=(LocalSocket&& other) noexcept {
+    if(this != &other) {
+        close();
+
+        mHandle = other.mHandle;
+        mPath = std::move(other.mPath);
+        mBuffer = std::move(other.mBuffer);
+
+        other.mHandle = INVALID_HANDLE;
+        other.mPath.clear();
+    }
+
+    return *this;
+}
+
+LocalSocket::~LocalSocket() {
+    close();
+}
+
+void LocalSocket::close() {
+    if(mHandle != INVALID_HANDLE)
+        closeHandle(mHandle);
+
+    if(!mPath.empty())
+        std::remove(mPath.c_str());
+
+    mHandle = INVALID_HANDLE;
+    mPath.clear();
+}
+
+LocalSocket LocalSocket::listen(const std::string& path) {
+    // A socket file nobody answers on is left over from a daemon that was killed
+    {
+        LocalSocket probe(createSocket());
+
+        if(connectSocket(probe.mHandle, path))
+            throw std::runtime_error("A daemon is already listening on " + path);
+    }
+
+    std::remove(path.c_str());
+
+    LocalSocket socket(createSocket());
+    const auto address = getAddress(path);
+
+    if(bind(socket.mHandle, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0)
+        throw std::runtime_error("Failed to bind " + path + " (error: " + std::strerror(errno) + ")");
+
+    // Only remove the socket file once it is ours
+    socket.mPath = path;
+
+    if(::listen(socket.mHandle, SOMAXCONN) != 0)
+        throw std::runtime_error("Failed to listen on " + path);
+
+    return socket;
+}
+
+LocalSocket LocalSocket::connect(const std::string& path) {
+    LocalSocket socket(createSocket());
+
+    if(!connectSocket(socket.mHandle, path))
+        throw std::runtime_error("No daemon is listening on " + path);
+
+    return socket;
+}
+
+std::string LocalSocket::getDefaultPath() {
+#ifdef _WIN32
+    const char* tempDir = std::getenv("TEMP");
+
+    return std::string(tempDir ? tempDir : ".") + "\\motioncam-fuse.sock";
+#else
+    if(const char* runtimeDir = std::getenv("XDG_RUNTIME_DIR"))
+        return std::string(runtimeDir) + "/motioncam-fuse.sock";
+
+    // Per user, so users on a shared render node don't talk to each other's daemon
+    return "/tmp/motioncam-fuse-" + std::to_string(getuid()) + ".sock";
+#endif
+}
+
+bool LocalSocket::waitForConnection(int timeoutMs) {
+    // Interrupted by a signal counts as a timeout, the caller checks why it was woken up
+    return pollHandle(mHandle, timeoutMs) > 0;
+}
+
+LocalSocket LocalSocket::accept() {
+    auto handle = static_cast<SocketHandle>(::accept(mHandle, nullptr, nullptr));
+    if(handle == INVALID_HANDLE)
+        throw std::runtime_error("Failed to accept connection");
+
+    return LocalSocket(handle);
+}
+
+bool LocalSocket::readLine(std::string& line) {
+    while(true) {
+        auto end = mBuffer.find('\n');
+
+        if(end != std::string::npos) {
+            line = mBuffer.substr(0, end);
+            mBuffer.erase(0, end + 1);
+
+            return true;
+        }
+
+        char data[4096];
+
+        const auto received = recv(mHandle, data, sizeof(data), 0);
+        if(received <= 0)
+            return false;
+
+        mBuffer.append(data, static_cast<size_t>(received));
+    }
+}
+
+void LocalSocket::write(const std::string& data) {
+    size_t sent = 0;
+
+    while(sent < data.size()) {
+        const auto result = send(mHandle, data.data() + sent, static_cast<int>(data.size() - sent), 0);
+        if(result <= 0)
+            throw std::runtime_error("Failed to write to socket");
+
+        sent += static_cast<size_t>(result);
+    }
+}
+
+} // namespace motioncam
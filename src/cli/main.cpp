@@ -0,0 +1,430 @@
+#include "DngExporter.h"
+#include "IFuseFileSystem.h"
+#include "cli/LocalSocket.h"
+
+#include <boost/filesystem.hpp>
+#include <spdlog/spdlog.h>
+
+#include <csignal>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include "win/FuseFileSystemImpl_Win.h"
+#elif __APPLE__
+#include "macos/FuseFileSystemImpl_MacOS.h"
+#elif __linux__
+#include "linux/FuseFileSystemImpl_Linux.h"
+#endif
+
+namespace fs = boost::filesystem;
+
+using namespace motioncam;
+
+namespace {
+    constexpr auto APP_NAME = "motioncam-fuse-cli";
+    constexpr auto DISK_CACHE_FOLDER = ".motioncam-cache";
+
+    // How often the daemon checks whether it was asked to stop while waiting for commands
+    constexpr int STOP_POLL_INTERVAL_MS = 250;
+
+    // Seconds between progress updates while exporting
+    constexpr double EXPORT_PROGRESS_INTERVAL = 0.5;
+
+    // Requests and replies are single lines of tab separated fields, replies start with OK or ERROR and
+    // end when the daemon closes the connection
+    constexpr char FIELD_SEPARATOR = '\t';
+
+    volatile std::sig_atomic_t gStopRequested = 0;
+
+    void onStopSignal(int) {
+        gStopRequested = 1;
+    }
+
+    struct Mount {
+        std::string srcFile;
+        std::string dstPath;
+        FileRenderOptions options;
+        int draftScale;
+    };
+
+    struct Arguments {
+        std::string command;
+        std::vector<std::string> positional;
+        std::vector<std::string> mountFiles;
+        std::string socketPath;
+        std::string cacheFolder;
+        FileRenderOptions options = RENDER_OPT_NONE;
+        int draftScale = 1;
+    };
+
+    void printUsage() {
+        std::cout <<
+            "Usage: " << APP_NAME << " <command> [options]\n"
+            "\n"
+            "Commands:\n"
+            "  daemon [--mount <file>]...          Run in the foreground and serve commands\n"
+            "  mount <file> [<mount point>]        Mount a file, next to it unless a mount point is given\n"
+            "  unmount <id>                        Unmount a file\n"
+            "  list                                List mounted files\n"
+            "  stats                               Show cache and queue statistics\n"
+            "  stop                                Unmount everything and stop the daemon\n"
+            "  export <file> <folder>              Write the DNGs and audio of a file to a folder, without the daemon\n"
+            "\n"
+            "Options:\n"
+            "  --socket <path>                     Socket the daemon listens on\n"
+            "                                      (default: " << LocalSocket::getDefaultPath() << ")\n"
+            "  --cache-folder <path>               Keep rendered frames on disk in this folder (daemon)\n"
+            "  --draft <2|4|8>                     Render frames scaled down (mount, export)\n"
+            "  --vignette-correction               Apply vignette correction (mount, export)\n"
+            "  --normalize-shading-map             Normalize the shading map (mount, export)\n";
+    }
+
+    std::vector<std::string> split(const std::string& line) {
+        std::vector<std::string> fields;
+        std::stringstream stream(line);
+        std::string field;
+
+        while(std::getline(stream, field, FIELD_SEPARATOR))
+            fields.push_back(field);
+
+        return fields;
+    }
+
+    std::string join(const std::vector<std::string>& fields) {
+        std::string line;
+
+        for(size_t i = 0; i < fields.size(); ++i) {
+            if(i > 0)
+                line += FIELD_SEPARATOR;
+
+            line += fields[i];
+        }
+
+        return line;
+    }
+
+    Arguments parseArguments(int argc, char* argv[]) {
+        Arguments args;
+
+        auto nextValue = [&](int& i) -> std::string {
+            if(i + 1 >= argc)
+                throw std::runtime_error(std::string("Missing value for ") + argv[i]);
+
+            return argv[++i];
+        };
+
+        for(int i = 1; i < argc; ++i) {
+            const std::string arg = argv[i];
+
+            if(arg == "--socket")
+                args.socketPath = nextValue(i);
+            else if(arg == "--cache-folder")
+                args.cacheFolder = nextValue(i);
+            else if(arg == "--mount")
+                args.mountFiles.push_back(nextValue(i));
+            else if(arg == "--draft") {
+                args.draftScale = std::stoi(nextValue(i));
+                args.options |= RENDER_OPT_DRAFT;
+
+                if(args.draftScale != 2 && args.draftScale != 4 && args.draftScale != 8)
+                    throw std::runtime_error("Draft scale must be 2, 4 or 8");
+            }
+            else if(arg == "--vignette-correction")
+                args.options |= RENDER_OPT_APPLY_VIGNETTE_CORRECTION;
+            else if(arg == "--normalize-shading-map")
+                args.options |= RENDER_OPT_NORMALIZE_SHADING_MAP;
+            else if(arg == "-h" || arg == "--help")
+                args.command = "help";
+            else if(!arg.empty() && arg[0] == '-')
+                throw std::runtime_error("Unknown option " + arg);
+            else if(args.command.empty())
+                args.command = arg;
+            else
+                args.positional.push_back(arg);
+        }
+
+        if(args.socketPath.empty())
+            args.socketPath = LocalSocket::getDefaultPath();
+
+        return args;
+    }
+
+    // Same layout as the app, the mount point is a folder named after the file next to it
+    std::string getDefaultMountPoint(const std::string& srcFile) {
+        fs::path path(srcFile);
+
+        return (path.parent_path() / path.stem()).string();
+    }
+
+    //
+    // Owns the file system and the mounts, handles one request at a time
+    //
+
+    class Daemon {
+    public:
+        Daemon() {
+        #ifdef _WIN32
+            mFuseFileSystem = std::make_unique<FuseFileSystemImpl_Win>();
+        #elif __APPLE__
+            mFuseFileSystem = std::make_unique<FuseFileSystemImpl_MacOs>();
+        #elif __linux__
+            mFuseFileSystem = std::make_unique<FuseFileSystemImpl_Linux>();
+        #endif
+        }
+
+        ~Daemon() {
+            for(const auto& [mountId, mount] : mMounts) {
+                spdlog::info("Unmounting {}", mount.srcFile);
+
+                mFuseFileSystem->unmount(mountId);
+            }
+        }
+
+        void setDiskCacheFolder(const std::string& path) {
+            mFuseFileSystem->setDiskCacheFolder((fs::path(path) / DISK_CACHE_FOLDER).string());
+        }
+
+        MountId mount(const Mount& mount) {
+            auto mountId = mFuseFileSystem->mount(mount.options, mount.draftScale, mount.srcFile, mount.dstPath);
+
+            mMounts[mountId] = mount;
+
+            spdlog::info("Mounted {} to {}", mount.srcFile, mount.dstPath);
+
+            return mountId;
+        }
+
+        // Returns the reply, stop is set when the daemon should exit after replying
+        std::string handle(const std::vector<std::string>& request, bool& stop) {
+            const auto& command = request.at(0);
+
+            if(command == "MOUNT" && request.size() == 5) {
+                Mount mount{
+                    request[1],
+                    request[2],
+                    static_cast<FileRenderOptions>(std::stoul(request[3])),
+                    std::stoi(request[4])
+                };
+
+                return "OK\n" + std::to_string(this->mount(mount)) + "\n";
+            }
+            else if(command == "UNMOUNT" && request.size() == 2) {
+                auto it = mMounts.find(std::stoi(request[1]));
+                if(it == mMounts.end())
+                    throw std::runtime_error("No mount with id " + request[1]);
+
+                mFuseFileSystem->unmount(it->first);
+
+                spdlog::info("Unmounted {}", it->second.srcFile);
+
+                mMounts.erase(it);
+
+                return "OK\n";
+            }
+            else if(command == "LIST") {
+                std::string reply = "OK\n";
+
+                for(const auto& [mountId, mount] : mMounts) {
+                    std::vector<std::string> fields = {
+                        std::to_string(mountId), mount.srcFile, mount.dstPath, optionsToString(mount.options) };
+
+                    if(auto info = mFuseFileSystem->getFileInfo(mountId)) {
+                        fields.push_back(std::to_string(info->width) + "x" + std::to_string(info->height));
+                        fields.push_back(std::to_string(info->fps));
+                        fields.push_back(std::to_string(info->totalFrames));
+                        fields.push_back(std::to_string(info->droppedFrames));
+                    }
+
+                    reply += join(fields) + "\n";
+                }
+
+                return reply;
+            }
+            else if(command == "STATS") {
+                const auto stats = mFuseFileSystem->getCacheStats();
+
+                std::stringstream reply;
+
+                reply << "OK\n"
+                      << "mounts" << FIELD_SEPARATOR << mMounts.size() << "\n"
+                      << "memory_cache_bytes" << FIELD_SEPARATOR << stats.memoryCacheSize << "\n"
+                      << "memory_cache_capacity" << FIELD_SEPARATOR << stats.memoryCacheCapacity << "\n"
+                      << "disk_cache_bytes" << FIELD_SEPARATOR << stats.diskCacheSize << "\n"
+                      << "disk_cache_capacity" << FIELD_SEPARATOR << stats.diskCacheCapacity << "\n"
+                      << "queued_reads" << FIELD_SEPARATOR << stats.queuedReads << "\n"
+                      << "queued_prefetches" << FIELD_SEPARATOR << stats.queuedPrefetches << "\n"
+                      << "average_read_wait_ms" << FIELD_SEPARATOR << stats.averageReadWaitMs << "\n";
+
+                return reply.str();
+            }
+            else if(command == "STOP") {
+                stop = true;
+
+                return "OK\n";
+            }
+
+            throw std::runtime_error("Invalid request " + command);
+        }
+
+    private:
+        std::unique_ptr<IFuseFileSystem> mFuseFileSystem;
+        std::map<MountId, Mount> mMounts;
+    };
+
+    int runDaemon(const Arguments& args) {
+        auto server = LocalSocket::listen(args.socketPath);
+
+        std::signal(SIGINT, onStopSignal);
+        std::signal(SIGTERM, onStopSignal);
+    #ifndef _WIN32
+        // Clients that go away before reading their reply must not take the daemon with them
+        std::signal(SIGPIPE, SIG_IGN);
+    #endif
+
+        Daemon daemon;
+
+        if(!args.cacheFolder.empty())
+            daemon.setDiskCacheFolder(args.cacheFolder);
+
+        for(const auto& file : args.mountFiles) {
+            const auto srcFile = fs::absolute(file).string();
+
+            try {
+                daemon.mount(Mount{ srcFile, getDefaultMountPoint(srcFile), args.options, args.draftScale });
+            }
+            catch(std::runtime_error& e) {
+                spdlog::error("Failed to mount {} (error: {})", srcFile, e.what());
+            }
+        }
+
+        spdlog::info("Listening on {}", args.socketPath);
+
+        bool stop = false;
+
+        while(!stop && !gStopRequested) {
+            if(!server.waitForConnection(STOP_POLL_INTERVAL_MS))
+                continue;
+
+            try {
+                auto client = server.accept();
+                std::string line;
+
+                if(!client.readLine(line))
+                    continue;
+
+                std::string reply;
+
+                try {
+                    reply = daemon.handle(split(line), stop);
+                }
+                catch(std::exception& e) {
+                    reply = std::string("ERROR") + FIELD_SEPARATOR + e.what() + "\n";
+                }
+
+                client.write(reply);
+            }
+            catch(std::runtime_error& e) {
+                spdlog::warn("Failed to handle request (error: {})", e.what());
+            }
+        }
+
+        spdlog::info("Stopping");
+
+        return 0;
+    }
+
+    int sendRequest(const Arguments& args, const std::vector<std::string>& request) {
+        auto socket = LocalSocket::connect(args.socketPath);
+
+        socket.write(join(request) + "\n");
+
+        std::string status;
+
+        if(!socket.readLine(status))
+            throw std::runtime_error("Daemon closed the connection");
+
+        const auto fields = split(status);
+
+        if(fields.empty() || fields[0] != "OK") {
+            std::cerr << (fields.size() > 1 ? fields[1] : status) << std::endl;
+            return 1;
+        }
+
+        std::string line;
+
+        while(socket.readLine(line))
+            std::cout << line << "\n";
+
+        return 0;
+    }
+
+    int runExport(const Arguments& args, const std::string& srcFile, const std::string& outputPath) {
+        DngExporter exporter(srcFile, outputPath, args.options, args.draftScale);
+        double lastProgress = 0;
+
+        const auto stats = exporter.run([&lastProgress](const ExportStats& progress) {
+            if(progress.frames < progress.totalFrames && progress.seconds - lastProgress < EXPORT_PROGRESS_INTERVAL)
+                return;
+
+            lastProgress = progress.seconds;
+
+            std::cerr << "\rExported " << progress.frames << "/" << progress.totalFrames << " frames, "
+                      << std::fixed << std::setprecision(1) << progress.framesPerSecond() << " frames/s" << std::flush;
+        });
+
+        std::cerr << std::endl;
+        std::cout << "Exported " << stats.files << " files to " << outputPath << " in "
+                  << std::fixed << std::setprecision(1) << stats.seconds << " s ("
+                  << stats.framesPerSecond() << " frames/s)" << std::endl;
+
+        return 0;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    try {
+        const auto args = parseArguments(argc, argv);
+
+        if(args.command == "daemon")
+            return runDaemon(args);
+
+        if(args.command == "mount" && (args.positional.size() == 1 || args.positional.size() == 2)) {
+            // The daemon doesn't share our working directory
+            const auto srcFile = fs::absolute(args.positional[0]).string();
+            const auto dstPath = args.positional.size() == 2 ?
+                fs::absolute(args.positional[1]).string() : getDefaultMountPoint(srcFile);
+
+            return sendRequest(args, {
+                "MOUNT", srcFile, dstPath, std::to_string(static_cast<unsigned int>(args.options)), std::to_string(args.draftScale) });
+        }
+
+        if(args.command == "unmount" && args.positional.size() == 1)
+            return sendRequest(args, { "UNMOUNT", args.positional[0] });
+
+        if(args.command == "list" && args.positional.empty())
+            return sendRequest(args, { "LIST" });
+
+        if(args.command == "stats" && args.positional.empty())
+            return sendRequest(args, { "STATS" });
+
+        if(args.command == "stop" && args.positional.empty())
+            return sendRequest(args, { "STOP" });
+
+        if(args.command == "export" && args.positional.size() == 2)
+            return runExport(args, args.positional[0], args.positional[1]);
+
+        printUsage();
+
+        return args.command == "help" ? 0 : 1;
+    }
+    catch(std::exception& e) {
+        std::cerr << APP_NAME << ": " << e.what() << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,688 @@
+#include "linux/FuseFileSystemImpl_Linux.h"
+#include "VirtualFileSystemImpl_MCRAW.h"
+#include "LRUCache.h"
+#include "DiskCache.h"
+#include "TaskScheduler.h"
+
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/filesystem.hpp>
+
+#include <climits>
+#include <condition_variable>
+#include <iostream>
+#include <mutex>
+#include <unordered_map>
+#include <pwd.h>
+#include <unistd.h>
+
+#include <fuse_lowlevel.h>
+
+// Logging
+#include <spdlog/spdlog.h>
+#include <spdlog/sinks/stdout_color_sinks.h>
+#include <spdlog/sinks/rotating_file_sink.h>
+
+namespace fs = boost::filesystem;
+
+namespace motioncam {
+
+constexpr auto CACHE_SIZE = 1024 * 1024 * 1024; // 1 GB cache size
+constexpr auto DISK_CACHE_SIZE = 16ull * 1024 * 1024 * 1024; // 16 GB, only used when a cache folder is set
+constexpr auto IO_THREADS = 4;
+constexpr auto MAX_READ_SIZE = 1024 * 1024; // Kernel caps this to its own max_pages limit
+constexpr auto ATTR_TIMEOUT = 60.0; // Attributes only change with the options, lookups pick up the new ones
+constexpr auto ENTRY_TIMEOUT = 1.0; // Names are looked up again this often, which refreshes the attributes
+
+namespace {
+
+std::string getLogDirectory() {
+    std::string logPath;
+
+    const char* stateHome = getenv("XDG_STATE_HOME");
+
+    if(stateHome && *stateHome) {
+        logPath = std::string(stateHome) + "/MotionCam Tools";
+    }
+    else {
+        const char* home = getenv("HOME");
+        if (!home) {
+            // Fallback to getpwuid if HOME is not set
+            struct passwd* pw = getpwuid(getuid());
+            home = pw->pw_dir;
+        }
+
+        logPath = std::string(home) + "/.local/state/MotionCam Tools";
+    }
+
+    // Create directory if it doesn't exist
+    fs::create_directories(logPath);
+
+    return logPath;
+}
+
+void setupLogging() {
+    try {
+        std::string logDir = getLogDirectory();
+        std::string logFile = logDir + "/fuse.txt";
+
+        std::vector<spdlog::sink_ptr> sinks;
+
+        // Console sink
+        sinks.push_back(std::make_shared<spdlog::sinks::stdout_color_sink_mt>());
+
+        // Rotating file sink: max 5MB per file, keep 3 files
+        sinks.push_back(std::make_shared<spdlog::sinks::rotating_file_sink_mt>(
+            logFile, 1024 * 1024 * 5, 3));
+
+        auto logger = std::make_shared<spdlog::logger>("multi_sink", sinks.begin(), sinks.end());
+        spdlog::set_default_logger(logger);
+
+#ifdef NDEBUG
+        spdlog::set_level(spdlog::level::info);
+#else
+        spdlog::set_level(spdlog::level::debug);
+#endif
+
+        spdlog::flush_on(spdlog::level::info);
+    }
+    catch (const spdlog::spdlog_ex& ex) {
+        std::cerr << "Log initialization failed: " << ex.what() << std::endl;
+    }
+    catch (const fs::filesystem_error& ex) {
+        std::cerr << "Failed to create log directory: " << ex.what() << std::endl;
+    }
+}
+
+// Inode numbers are the index into the directory listing, offset past the root inode
+inline fuse_ino_t toInode(size_t index) {
+    return static_cast<fuse_ino_t>(index + FUSE_ROOT_ID + 1);
+}
+
+inline size_t toIndex(fuse_ino_t ino) {
+    return static_cast<size_t>(ino - FUSE_ROOT_ID - 1);
+}
+
+// Falls back to the mount time if the source can't be read
+time_t getModifiedTime(const std::string& path) {
+    boost::system::error_code ec;
+
+    auto modifiedTime = fs::last_write_time(path, ec);
+
+    return ec ? time(NULL) : modifiedTime;
+}
+
+void fillStat(fuse_ino_t ino, const Entry& entry, time_t modifiedTime, struct stat& stbuf) {
+    memset(&stbuf, 0, sizeof(struct stat));
+
+    stbuf.st_ino = ino;
+
+    if(entry.type == EntryType::DIRECTORY_ENTRY) {
+        stbuf.st_mode = S_IFDIR | 0755;
+        stbuf.st_nlink = 2;
+        stbuf.st_size = 4096;
+    }
+    else {
+        stbuf.st_mode = S_IFREG | 0444;
+        stbuf.st_nlink = 1;
+        stbuf.st_size = entry.size;
+    }
+
+    // Must stay the same between getattr calls, the kernel drops cached pages of files whose mtime changes
+    stbuf.st_mtime = stbuf.st_ctime = modifiedTime;
+    stbuf.st_uid = getuid();
+    stbuf.st_gid = getgid();
+}
+
+void fillRootStat(struct stat& stbuf) {
+    memset(&stbuf, 0, sizeof(struct stat));
+
+    stbuf.st_ino = FUSE_ROOT_ID;
+    stbuf.st_mode = S_IFDIR | 0755;
+    stbuf.st_nlink = 2;
+}
+
+} // namespace
+
+//
+
+struct Directory {
+    std::vector<Entry> entries;
+    time_t modifiedTime;
+    std::unordered_map<std::string, fuse_ino_t> inodes;
+};
+
+class Session {
+public:
+    Session(const std::string& srcFile, const std::string& dstPath, std::unique_ptr<VirtualFileSystemImpl_MCRAW> fs);
+    ~Session();
+
+    void updateOptions(FileRenderOptions options, int draftScale);
+    FileInfo getFileInfo() const;
+
+private:
+    void init();
+    void refreshDirectory();
+    std::shared_ptr<const Directory> getDirectory() const;
+
+    void beginRequest();
+    void endRequest();
+
+    void fuseMain(struct fuse_session* session);
+
+    static Session* fromRequest(fuse_req_t req);
+
+    static void fuseInit(void* userData, struct fuse_conn_info* conn);
+    static void fuseLookup(fuse_req_t req, fuse_ino_t parent, const char* name);
+    static void fuseGetattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi);
+    static void fuseOpendir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi);
+    static void fuseReaddir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t offset, struct fuse_file_info* fi);
+    static void fuseReleasedir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi);
+    static void fuseOpen(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi);
+    static void fuseRead(fuse_req_t req, fuse_ino_t ino, size_t size, off_t offset, struct fuse_file_info* fi);
+    static void fuseRelease(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi);
+
+private:
+    std::string mSrcFile;
+    std::string mDstPath;
+    const time_t mSourceModifiedTime;
+    int mOptionsChanges; // Moves the mtime forward each time the options change the file contents
+    std::unique_ptr<std::thread> mThread;
+    std::unique_ptr<VirtualFileSystemImpl_MCRAW> mFs;
+    struct fuse_session* mSession;
+    std::atomic_uint64_t mNextFileHandle;
+
+    mutable std::mutex mDirectoryLock;
+    std::shared_ptr<const Directory> mDirectory;
+
+    std::mutex mPendingLock;
+    std::condition_variable mPendingCondition;
+    int mPendingRequests;
+};
+
+
+Session::Session(const std::string& srcFile, const std::string& dstPath, std::unique_ptr<VirtualFileSystemImpl_MCRAW> fs) :
+    mSrcFile(srcFile),
+    mDstPath(dstPath),
+    mSourceModifiedTime(getModifiedTime(srcFile)),
+    mOptionsChanges(0),
+    mFs(std::move(fs)),
+    mSession(nullptr),
+    mNextFileHandle(0),
+    mPendingRequests(0)
+{
+    refreshDirectory();
+
+    init();
+}
+
+Session::~Session() {
+    if(mSession) {
+        spdlog::debug("Unmounting {}", mDstPath);
+
+        // Unmounting aborts the connection, which wakes up the worker threads so the loop can exit
+        fuse_session_exit(mSession);
+        fuse_session_unmount(mSession);
+
+        spdlog::debug("Umounted {}", mDstPath);
+    }
+
+    if(mThread && mThread->joinable())
+        mThread->join();
+
+    // Reads that are still rendering reply through the session, wait for them before destroying it
+    {
+        std::unique_lock<std::mutex> lock(mPendingLock);
+        mPendingCondition.wait(lock, [this] { return mPendingRequests == 0; });
+    }
+
+    if(mSession)
+        fuse_session_destroy(mSession);
+
+    mSession = nullptr;
+
+    boost::system::error_code ec;
+
+    if(!fs::remove(mDstPath, ec))
+        spdlog::warn("Failed to remove {}", mDstPath);
+
+    spdlog::debug("Exiting session for {}", mSrcFile);
+}
+
+void Session::init() {
+    // FUSE operations structure
+    struct fuse_lowlevel_ops ops = {};
+
+    ops.init = fuseInit;
+    ops.lookup = fuseLookup;
+    ops.getattr = fuseGetattr;
+    ops.opendir = fuseOpendir;
+    ops.readdir = fuseReaddir;
+    ops.releasedir = fuseReleasedir;
+    ops.open = fuseOpen;
+    ops.read = fuseRead;
+    ops.release = fuseRelease;
+
+    struct fuse_args args = FUSE_ARGS_INIT(0, nullptr);
+
+    const auto maxReadOption = "max_read=" + std::to_string(MAX_READ_SIZE);
+
+    // Read only
+    fuse_opt_add_arg(&args, "motioncam-fs");
+    fuse_opt_add_arg(&args, "-o");
+    fuse_opt_add_arg(&args, "ro");
+    fuse_opt_add_arg(&args, "-o");
+    fuse_opt_add_arg(&args, "fsname=motioncam,subtype=mcraw");
+    fuse_opt_add_arg(&args, "-o");
+    fuse_opt_add_arg(&args, maxReadOption.c_str());
+
+    struct fuse_session* session = fuse_session_new(&args, &ops, sizeof(ops), this);
+
+    // Clean up
+    fuse_opt_free_args(&args);
+
+    if (session == nullptr)
+        throw std::runtime_error("Failed to create mount point (path: " + mDstPath + ")");
+
+    if (fuse_session_mount(session, mDstPath.c_str()) != 0) {
+        fuse_session_destroy(session);
+        throw std::runtime_error("Failed to create mount point (path: " + mDstPath + ")");
+    }
+
+    mSession = session;
+
+    // Start fuse thread
+    mThread = std::make_unique<std::thread>(&Session::fuseMain, this, session);
+}
+
+void Session::refreshDirectory() {
+    auto directory = std::make_shared<Directory>();
+
+    directory->entries = mFs->listFiles();
+    directory->modifiedTime = mSourceModifiedTime + mOptionsChanges;
+
+    for(size_t i = 0; i < directory->entries.size(); ++i)
+        directory->inodes[directory->entries[i].getFullPath().string()] = toInode(i);
+
+    std::lock_guard<std::mutex> lock(mDirectoryLock);
+
+    mDirectory = std::move(directory);
+}
+
+std::shared_ptr<const Directory> Session::getDirectory() const {
+    std::lock_guard<std::mutex> lock(mDirectoryLock);
+
+    return mDirectory;
+}
+
+void Session::beginRequest() {
+    std::lock_guard<std::mutex> lock(mPendingLock);
+
+    ++mPendingRequests;
+}
+
+void Session::endRequest() {
+    std::lock_guard<std::mutex> lock(mPendingLock);
+
+    if(--mPendingRequests == 0)
+        mPendingCondition.notify_all();
+}
+
+void Session::updateOptions(FileRenderOptions options, int draftScale) {
+    mFs->updateOptions(options, draftScale);
+
+    ++mOptionsChanges;
+
+    refreshDirectory();
+
+    // Only the directory listing is dropped, invalidating every name would be one kernel round trip per frame. Names
+    // expire after ENTRY_TIMEOUT, the lookup then picks up the new size and mtime and the mtime change makes the
+    // kernel drop the pages it cached with the old options.
+    fuse_lowlevel_notify_inval_inode(mSession, FUSE_ROOT_ID, 0, 0);
+}
+
+FileInfo Session::getFileInfo() const {
+    return mFs->getFileInfo();
+}
+
+void Session::fuseMain(struct fuse_session* session) {
+    int res = fuse_session_loop_mt(session, 0);
+
+    spdlog::info("Fuse has exited with code {}", res);
+}
+
+Session* Session::fromRequest(fuse_req_t req) {
+    return reinterpret_cast<Session*>(fuse_req_userdata(req));
+}
+
+void Session::fuseInit(void* userData, struct fuse_conn_info* conn) {
+    // Large reads straight from the kernel page cache
+    conn->max_read = MAX_READ_SIZE;
+    conn->max_readahead = MAX_READ_SIZE;
+
+    if(conn->capable & FUSE_CAP_ASYNC_READ)
+        conn->want |= FUSE_CAP_ASYNC_READ;
+
+    // Cached pages are dropped when the mtime of a file changes
+    if(conn->capable & FUSE_CAP_AUTO_INVAL_DATA)
+        conn->want |= FUSE_CAP_AUTO_INVAL_DATA;
+}
+
+void Session::fuseLookup(fuse_req_t req, fuse_ino_t parent, const char* name) {
+    spdlog::debug("fuse_lookup(parent: {}, name: {})", parent, name);
+
+    auto directory = fromRequest(req)->getDirectory();
+
+    if(parent != FUSE_ROOT_ID) {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+
+    auto it = directory->inodes.find(name);
+    if(it == directory->inodes.end()) {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+
+    struct fuse_entry_param e = {};
+
+    e.ino = it->second;
+    e.attr_timeout = ATTR_TIMEOUT;
+    e.entry_timeout = ENTRY_TIMEOUT;
+
+    fillStat(e.ino, directory->entries[toIndex(e.ino)], directory->modifiedTime, e.attr);
+
+    fuse_reply_entry(req, &e);
+}
+
+void Session::fuseGetattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi) {
+    spdlog::debug("fuse_get_attr(ino: {})", ino);
+
+    struct stat stbuf;
+
+    if(ino == FUSE_ROOT_ID) {
+        fillRootStat(stbuf);
+        fuse_reply_attr(req, &stbuf, ATTR_TIMEOUT);
+        return;
+    }
+
+    auto directory = fromRequest(req)->getDirectory();
+    auto index = toIndex(ino);
+
+    if(index >= directory->entries.size()) {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+
+    fillStat(ino, directory->entries[index], directory->modifiedTime, stbuf);
+
+    fuse_reply_attr(req, &stbuf, ATTR_TIMEOUT);
+}
+
+void Session::fuseOpendir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi) {
+    spdlog::debug("fuse_open_dir(ino: {})", ino);
+
+    if(ino != FUSE_ROOT_ID) {
+        fuse_reply_err(req, ENOTDIR);
+        return;
+    }
+
+    // Build the listing once per handle so that offsets stay stable across readdir calls
+    auto directory = fromRequest(req)->getDirectory();
+    auto* listing = new std::vector<char>();
+
+    auto addEntry = [req, listing](const char* name, fuse_ino_t entryIno, mode_t mode) {
+        struct stat stbuf = {};
+
+        stbuf.st_ino = entryIno;
+        stbuf.st_mode = mode;
+
+        auto oldSize = listing->size();
+        auto entrySize = fuse_add_direntry(req, nullptr, 0, name, nullptr, 0);
+
+        listing->resize(oldSize + entrySize);
+
+        fuse_add_direntry(req, listing->data() + oldSize, entrySize, name, &stbuf, listing->size());
+    };
+
+    addEntry(".", FUSE_ROOT_ID, S_IFDIR);
+    addEntry("..", FUSE_ROOT_ID, S_IFDIR);
+
+    for(size_t i = 0; i < directory->entries.size(); ++i) {
+        const auto& entry = directory->entries[i];
+
+        addEntry(
+            entry.getFullPath().c_str(),
+            toInode(i),
+            entry.type == EntryType::DIRECTORY_ENTRY ? S_IFDIR : S_IFREG);
+    }
+
+    fi->fh = reinterpret_cast<uint64_t>(listing);
+
+    fuse_reply_open(req, fi);
+}
+
+void Session::fuseReaddir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t offset, struct fuse_file_info* fi) {
+    spdlog::debug("fuse_read_dir(ino: {}, size: {}, offset: {})", ino, size, offset);
+
+    auto* listing = reinterpret_cast<std::vector<char>*>(fi->fh);
+
+    if(offset < 0 || static_cast<size_t>(offset) >= listing->size()) {
+        fuse_reply_buf(req, nullptr, 0);
+        return;
+    }
+
+    fuse_reply_buf(req, listing->data() + offset, (std::min)(size, listing->size() - static_cast<size_t>(offset)));
+}
+
+void Session::fuseReleasedir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi) {
+    delete reinterpret_cast<std::vector<char>*>(fi->fh);
+
+    fuse_reply_err(req, 0);
+}
+
+void Session::fuseOpen(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi) {
+    spdlog::debug("fuse_open(ino: {})", ino);
+
+    auto* session = fromRequest(req);
+    auto directory = session->getDirectory();
+
+    if(toIndex(ino) >= directory->entries.size()) {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+
+    // Only allow read access
+    if ((fi->flags & O_ACCMODE) != O_RDONLY) {
+        fuse_reply_err(req, EACCES);
+        return;
+    }
+
+    // Keep pages cached by the kernel between opens
+    fi->keep_cache = 1;
+
+    // Set file handle
+    fi->fh = ++session->mNextFileHandle;
+
+    fuse_reply_open(req, fi);
+}
+
+void Session::fuseRead(fuse_req_t req, fuse_ino_t ino, size_t size, off_t offset, struct fuse_file_info* fi) {
+    spdlog::debug("fuse_read(ino: {}, size: {}, offset: {})", ino, size, offset);
+
+    auto* session = fromRequest(req);
+    auto directory = session->getDirectory();
+    auto index = toIndex(ino);
+
+    if(index >= directory->entries.size()) {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+
+    const auto& entry = directory->entries[index];
+
+    // Nothing to render past the end of the file
+    if(offset < 0 || static_cast<size_t>(offset) >= entry.size) {
+        fuse_reply_buf(req, nullptr, 0);
+        return;
+    }
+
+    // The buffer has to outlive this call since the reply may be sent from a processing thread
+    auto buffer = std::make_shared<std::vector<char>>((std::min)(size, entry.size - static_cast<size_t>(offset)));
+
+    session->beginRequest();
+
+    auto reply = [session, req, buffer](size_t readBytes, int error) {
+        if(error == ECANCELED)
+            fuse_reply_err(req, EINTR);
+        else if(error != 0)
+            fuse_reply_err(req, EIO);
+        else
+            fuse_reply_buf(req, buffer->data(), readBytes);
+
+        session->endRequest();
+    };
+
+    // The kernel interrupts reads when the reader is killed or gives up, those are dropped if still queued
+    auto isCancelled = [req]() {
+        return fuse_req_interrupted(req) != 0;
+    };
+
+    auto result = session->mFs->readFile(
+        entry,
+        offset,
+        buffer->size(),
+        buffer->data(),
+        reply,
+        true,
+        isCancelled);
+
+    // Queued reads reply through the callback, everything else completed here (cache hit, end of file or failed).
+    // The file can shrink between the directory snapshot and the read when the options change, so zero bytes is
+    // a valid reply too.
+    if(result == READ_PENDING)
+        return;
+
+    if(result >= 0)
+        reply(result, 0);
+    else
+        reply(0, result);
+}
+
+void Session::fuseRelease(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi) {
+    fuse_reply_err(req, 0);
+}
+
+//
+
+FuseFileSystemImpl_Linux::FuseFileSystemImpl_Linux() :
+    mNextMountId(0),
+    mIoThreadPool(std::make_unique<TaskScheduler>("IO", IO_THREADS)),
+    mProcessingThreadPool(std::make_unique<TaskScheduler>("Processing")),
+    mCache(std::make_unique<LRUCache>(CACHE_SIZE)),
+    mDiskCache(std::make_unique<DiskCache>(DISK_CACHE_SIZE))
+{
+    setupLogging();
+}
+
+FuseFileSystemImpl_Linux::~FuseFileSystemImpl_Linux() {
+    mMountedFiles.clear();
+
+    // Wait for tasks to complete before we destroy ourselves
+    mIoThreadPool->wait();
+
+    mProcessingThreadPool->wait();
+
+    spdlog::info("Destroying FuseFileSystemImpl_Linux()");
+}
+
+MountId FuseFileSystemImpl_Linux::mount(
+    FileRenderOptions options, int draftScale, const std::string& srcFile, const std::string& dstPath)
+{
+    fs::path srcPath(srcFile);
+    std::string extension = srcPath.extension().string();
+
+    spdlog::debug("Mounting file {} to {}", srcFile, dstPath);
+
+    if(!fs::exists(dstPath)) {
+        spdlog::info("Creating path {}", dstPath);
+
+        boost::system::error_code ec;
+
+        if(!fs::create_directories(dstPath, ec)) {
+            spdlog::error("Could not create path {}", dstPath);
+
+            throw std::runtime_error("Failed to create " + dstPath);
+        }
+    }
+
+    if(boost::iequals(extension, ".mcraw")) {
+        auto mountId = mNextMountId++;
+
+        try {
+            auto fs = std::make_unique<VirtualFileSystemImpl_MCRAW>(
+                *mIoThreadPool,
+                *mProcessingThreadPool,
+                *mCache,
+                *mDiskCache,
+                options,
+                draftScale,
+                srcFile);
+
+            mMountedFiles[mountId] = std::make_unique<Session>(srcFile, dstPath, std::move(fs));
+        }
+        catch(std::runtime_error& e) {
+            spdlog::error("Failed to mount {} to {} (error: {})", srcFile, dstPath, e.what());
+
+            throw std::runtime_error(e.what());
+        }
+
+        return mountId;
+    }
+
+    spdlog::error("Failed to mount {} to {}, invalid file format", srcFile, dstPath);
+
+    throw std::runtime_error("Invalid format");
+}
+
+void FuseFileSystemImpl_Linux::unmount(MountId mountId) {
+    auto it = mMountedFiles.find(mountId);
+    if(it != mMountedFiles.end()) {
+        mMountedFiles.erase(it);
+    }
+}
+
+void FuseFileSystemImpl_Linux::updateOptions(MountId mountId, FileRenderOptions options, int draftScale) {
+    auto it = mMountedFiles.find(mountId);
+    if(it != mMountedFiles.end()) {
+        it->second->updateOptions(options, draftScale);
+    }
+}
+
+std::optional<FileInfo> FuseFileSystemImpl_Linux::getFileInfo(MountId mountId) {
+    auto it = mMountedFiles.find(mountId);
+    if(it != mMountedFiles.end()) {
+        return it->second->getFileInfo();
+    }
+    return std::nullopt;
+}
+
+void FuseFileSystemImpl_Linux::setDiskCacheFolder(const std::string& path) {
+    mDiskCache->setFolder(path);
+}
+
+CacheStats FuseFileSystemImpl_Linux::getCacheStats() const {
+    const auto reads = mProcessingThreadPool->getStats(TASK_PRIORITY_FOREGROUND);
+    const auto prefetches = mProcessingThreadPool->getStats(TASK_PRIORITY_PREFETCH);
+
+    return CacheStats{
+        mCache->size(),
+        mCache->capacity(),
+        mDiskCache->size(),
+        mDiskCache->capacity(),
+        reads.queued,
+        prefetches.queued,
+        reads.averageWaitMs
+    };
+}
+
+} // namespace motioncam
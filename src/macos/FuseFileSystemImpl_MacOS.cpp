@@ -1,6 +1,8 @@
 #include "macos/FuseFileSystemImpl_MacOS.h"
 #include "VirtualFileSystemImpl_MCRAW.h"
 #include "LRUCache.h"
+#include "DiskCache.h"
+#include "TaskScheduler.h"
 
 #include <boost/algorithm/string/predicate.hpp>
 #include <boost/filesystem.hpp>
@@ -9,9 +11,7 @@
 #include <pwd.h>
 #include <unistd.h>
 
-#include <BS_thread_pool.hpp>
 #include <fuse_t/fuse_t.h>
-#include <QDir>
 
 // Logging
 #include <spdlog/spdlog.h>
@@ -23,6 +23,7 @@ namespace fs = boost::filesystem;
 namespace motioncam {
 
 constexpr auto CACHE_SIZE = 1024 * 1024 * 1024; // 1 GB cache size
+constexpr auto DISK_CACHE_SIZE = 16ull * 1024 * 1024 * 1024; // 16 GB, only used when a cache folder is set
 constexpr auto IO_THREADS = 4;
 
 namespace {
@@ -145,9 +146,10 @@ Session::~Session() {
     if(mThread && mThread->joinable())
         mThread->join();
 
-    QDir dst;
+    // Only removes the mount point if it is empty
+    boost::system::error_code ec;
 
-    if(!dst.rmdir(mDstPath.c_str()))
+    if(!fs::remove(mDstPath, ec))
         spdlog::warn("Failed to remove {}", mDstPath);
 
     spdlog::debug("Exiting session for {}", mSrcFile);
@@ -368,9 +370,10 @@ int Session::fuseRelease(const char* path, struct fuse_file_info* fi) {
 
 FuseFileSystemImpl_MacOs::FuseFileSystemImpl_MacOs() :
     mNextMountId(0),
-    mIoThreadPool(std::make_unique<BS::thread_pool>(IO_THREADS)),
-    mProcessingThreadPool(std::make_unique<BS::thread_pool>()),
-    mCache(std::make_unique<LRUCache>(CACHE_SIZE))
+    mIoThreadPool(std::make_unique<TaskScheduler>("IO", IO_THREADS)),
+    mProcessingThreadPool(std::make_unique<TaskScheduler>("Processing")),
+    mCache(std::make_unique<LRUCache>(CACHE_SIZE)),
+    mDiskCache(std::make_unique<DiskCache>(DISK_CACHE_SIZE))
 {
     setupLogging();
 }
@@ -394,12 +397,12 @@ MountId FuseFileSystemImpl_MacOs::mount(
 
     spdlog::debug("Mounting file {} to {}", srcFile, dstPath);
 
-    QDir dst(dstPath.c_str());
-
-    if(!dst.exists()) {
+    if(!fs::exists(dstPath)) {
         spdlog::info("Creating path {}", dstPath);
 
-        if(!dst.mkpath(dstPath.c_str())) {
+        boost::system::error_code ec;
+
+        if(!fs::create_directories(dstPath, ec)) {
             spdlog::error("Could not create path {}", dstPath);
 
             throw std::runtime_error("Failed to create " + dstPath);
@@ -418,6 +421,7 @@ MountId FuseFileSystemImpl_MacOs::mount(
                     *mIoThreadPool,
                     *mProcessingThreadPool,
                     *mCache,
+                    *mDiskCache,
                     options,
                     draftScale,
                     srcFile);
@@ -468,4 +472,23 @@ std::optional<FileInfo> FuseFileSystemImpl_MacOs::getFileInfo(MountId mountId) {
     return std::nullopt;
 }
 
+void FuseFileSystemImpl_MacOs::setDiskCacheFolder(const std::string& path) {
+    mDiskCache->setFolder(path);
+}
+
+CacheStats FuseFileSystemImpl_MacOs::getCacheStats() const {
+    const auto reads = mProcessingThreadPool->getStats(TASK_PRIORITY_FOREGROUND);
+    const auto prefetches = mProcessingThreadPool->getStats(TASK_PRIORITY_PREFETCH);
+
+    return CacheStats{
+        mCache->size(),
+        mCache->capacity(),
+        mDiskCache->size(),
+        mDiskCache->capacity(),
+        reads.queued,
+        prefetches.queued,
+        reads.averageWaitMs
+    };
+}
+
 } // namespace motioncam
@@ -17,11 +17,14 @@
 #include "win/FuseFileSystemImpl_Win.h"
 #elif __APPLE__
 #include "macos/FuseFileSystemImpl_MacOS.h"
+#elif __linux__
+#include "linux/FuseFileSystemImpl_Linux.h"
 #endif
 
 namespace {
     constexpr auto PACKAGE_NAME = "com.motioncam";
     constexpr auto APP_NAME = "MotionCam FS";
+    constexpr auto DISK_CACHE_FOLDER = ".motioncam-cache";
 
     motioncam::FileRenderOptions getRenderOptions(Ui::MainWindow& ui) {
         motioncam::FileRenderOptions options = motioncam::RENDER_OPT_NONE;
@@ -50,6 +53,8 @@ MainWindow::MainWindow(QWidget *parent)
     mFuseFilesystem = std::make_unique<motioncam::FuseFileSystemImpl_Win>();
 #elif __APPLE__
     mFuseFilesystem = std::make_unique<motioncam::FuseFileSystemImpl_MacOs>();
+#elif __linux__
+    mFuseFilesystem = std::make_unique<motioncam::FuseFileSystemImpl_Linux>();
 #endif
 
     // Enable drag and drop on the scroll area
@@ -106,6 +111,8 @@ void MainWindow::restoreSettings() {
         settings.value("scaleRaw").toBool() ? Qt::CheckState::Checked : Qt::CheckState::Unchecked);
 
     mCacheRootFolder = settings.value("cachePath").toString();    
+    updateDiskCache();
+
     mDraftQuality = std::max(1, settings.value("draftQuality").toInt());
 
     if(mDraftQuality == 2)
@@ -334,6 +341,8 @@ void MainWindow::openMountedDirectory(QWidget* fileWidget) {
     success = QProcess::startDetached("explorer", QStringList() << QDir::toNativeSeparators(mountPath));
 #elif __APPLE__
     success = QProcess::startDetached("/usr/bin/open", QStringList() << mountPath);
+#elif __linux__
+    success = QProcess::startDetached("xdg-open", QStringList() << mountPath);
 #endif
 
     if (!success)
@@ -405,6 +414,14 @@ void MainWindow::updateUi() {
     }
 }
 
+void MainWindow::updateDiskCache() {
+    // Rendered frames are only kept on disk when there is a cache folder
+    if (mCacheRootFolder.isEmpty())
+        mFuseFilesystem->setDiskCacheFolder("");
+    else
+        mFuseFilesystem->setDiskCacheFolder(QDir(mCacheRootFolder).filePath(DISK_CACHE_FOLDER).toStdString());
+}
+
 void MainWindow::onRenderSettingsChanged(const Qt::CheckState &checkState) {
     auto it = mMountedFiles.begin();
     auto renderOptions = getRenderOptions(*ui);
@@ -439,6 +456,8 @@ void MainWindow::onSetCacheFolder(bool checked) {
     );
 
     mCacheRootFolder = folderPath;
+    updateDiskCache();
+
     if (mCacheRootFolder.isEmpty()) {
         ui->cacheFolderLabel->setText("<i>Same as source file</i>");
         ui->cacheFolderLabel->setStyleSheet("color: white; font-weight: bold; font-style: italic;");
@@ -4,10 +4,14 @@
 
 #include "VirtualFileSystemImpl_MCRAW.h"
 #include "LRUCache.h"
+#include "DiskCache.h"
+#include "TaskScheduler.h"
 
+#include <cerrno>
 #include <iostream>
 #include <ntstatus.h>
 #include <mutex>
+#include <map>
 #include <filesystem>
 #include <shlobj.h>
 
@@ -15,7 +19,6 @@
 #include <boost/algorithm/string.hpp>
 #include <boost/locale.hpp>
 
-#include <BS_thread_pool.hpp>
 
 // Logging
 #include <spdlog/spdlog.h>
@@ -30,6 +33,7 @@ namespace lcv = boost::locale::conv;
 namespace motioncam {
 
 constexpr auto CACHE_SIZE = 128 * 1024 * 1024; // Small cache size as we write the files to disk
+constexpr auto DISK_CACHE_SIZE = 16ull * 1024 * 1024 * 1024; // 16 GB, only used when a cache folder is set
 constexpr auto IO_THREADS = 4;
 
 namespace {
@@ -108,19 +112,26 @@ protected:
         _In_opt_ PCWSTR DestinationFileName,
         _Inout_ PRJ_NOTIFICATION_PARAMETERS* NotificationParameters) override;
 
+    void CancelCommand(_In_ const PRJ_CALLBACK_DATA* CallbackData) override;
+
+private:
+    bool isCommandCancelled(INT32 commandId);
+
 private:
     FileRenderOptions mOptions;
     int mDraftScale;
     std::mutex mOpLock;
     std::unique_ptr<VirtualFileSystemImpl_MCRAW> mFs;
     std::map<GUID, std::unique_ptr<DirInfo>, GUIDComparer> mActiveEnumSessions;
+    std::mutex mCancelLock;
+    std::map<INT32, bool> mPendingCommands; // Reads in flight, true once ProjFS has cancelled them
 };
 
 Session::Session(
     const std::string& dstPath,
     std::unique_ptr<VirtualFileSystemImpl_MCRAW> fs) : mFs(std::move(fs))
 {
-    SetOptionalMethods(OptionalMethods::Notify);
+    SetOptionalMethods(OptionalMethods::Notify | OptionalMethods::CancelCommand);
 
     // Specify the notifications that we want ProjFS to send to us.  Everywhere under the virtualization
     // root we want ProjFS to tell us when files have been opened, when they're about to be renamed,
@@ -383,9 +394,20 @@ HRESULT Session::GetFileData(_In_ const PRJ_CALLBACK_DATA* callbackData, _In_ UI
         return E_OUTOFMEMORY;
     }
 
-    auto completeTransaction = [this, writeBuffer, byteOffset, length, fileName, commandId, dataStramId](size_t readBytes, int error, bool isAsync) {
+    auto completeTransaction = [this, writeBuffer, byteOffset, length, fileName, commandId, dataStramId](size_t readBytes, int error, bool isAsync) -> HRESULT {
         HRESULT hr = S_OK;
 
+        {
+            std::lock_guard<std::mutex> lock(mCancelLock);
+            mPendingCommands.erase(commandId);
+        }
+
+        // ProjFS has already given up on cancelled commands, they must not be completed
+        if(error == ECANCELED) {
+            PrjFreeAlignedBuffer(writeBuffer);
+            return HRESULT_FROM_WIN32(ERROR_OPERATION_ABORTED);
+        }
+
         if(readBytes == length) {
             hr = WriteFileData(&dataStramId, reinterpret_cast<PVOID>(writeBuffer), byteOffset, length);
         }
@@ -409,10 +431,18 @@ HRESULT Session::GetFileData(_In_ const PRJ_CALLBACK_DATA* callbackData, _In_ UI
 
         if(isAsync)
             PrjCompleteCommand(_instanceHandle, commandId, hr, nullptr);
+
+        return hr;
     };
 
     auto asyncCompleteTransaction = std::bind(completeTransaction, std::placeholders::_1, std::placeholders::_2, true);
 
+    // Cancellations only apply while the read is pending, ProjFS can send them after it has completed
+    {
+        std::lock_guard<std::mutex> lock(mCancelLock);
+        mPendingCommands[commandId] = false;
+    }
+
     // Read the data asynchronously
     auto result = mFs->readFile(
         *fsEntry,
@@ -420,14 +450,33 @@ HRESULT Session::GetFileData(_In_ const PRJ_CALLBACK_DATA* callbackData, _In_ UI
         length,
         writeBuffer,
         asyncCompleteTransaction,
-        true);
+        true,
+        [this, commandId]() { return isCommandCancelled(commandId); });
 
-    if(result > 0) {
-        completeTransaction(result, 0, false);
-        return hr;
-    }
-    else // async read
+    if(result == READ_PENDING)
         return HRESULT_FROM_WIN32(ERROR_IO_PENDING);
+
+    // Completed synchronously, a short or failed read fails the command
+    return completeTransaction(result > 0 ? static_cast<size_t>(result) : 0, result < 0 ? EIO : 0, false);
+}
+
+void Session::CancelCommand(_In_ const PRJ_CALLBACK_DATA* CallbackData) {
+    spdlog::debug("CancelCommand(): Command {}", CallbackData->CommandId);
+
+    // Reads that haven't started yet are dropped, running ones complete as usual
+    std::lock_guard<std::mutex> lock(mCancelLock);
+
+    auto it = mPendingCommands.find(CallbackData->CommandId);
+    if(it != mPendingCommands.end())
+        it->second = true;
+}
+
+bool Session::isCommandCancelled(INT32 commandId) {
+    std::lock_guard<std::mutex> lock(mCancelLock);
+
+    auto it = mPendingCommands.find(commandId);
+
+    return it != mPendingCommands.end() && it->second;
 }
 
 HRESULT Session::Notify(
@@ -542,9 +591,10 @@ void setupLogging() {
 
 FuseFileSystemImpl_Win::FuseFileSystemImpl_Win() :
     mNextMountId(0),
-    mIoThreadPool(std::make_unique<BS::thread_pool>(IO_THREADS)),
-    mProcessingThreadPool(std::make_unique<BS::thread_pool>()),
-    mCache(std::make_unique<LRUCache>(CACHE_SIZE))
+    mIoThreadPool(std::make_unique<TaskScheduler>("IO", IO_THREADS)),
+    mProcessingThreadPool(std::make_unique<TaskScheduler>("Processing")),
+    mCache(std::make_unique<LRUCache>(CACHE_SIZE)),
+    mDiskCache(std::make_unique<DiskCache>(DISK_CACHE_SIZE))
 {
     setupLogging();
 }
@@ -559,7 +609,7 @@ MountId FuseFileSystemImpl_Win::mount(FileRenderOptions options, int draftScale,
         auto mountId = mNextMountId++;
 
         try {
-            auto fs = std::make_unique<VirtualFileSystemImpl_MCRAW>(*mIoThreadPool, *mProcessingThreadPool, *mCache, options, draftScale, srcFile);
+            auto fs = std::make_unique<VirtualFileSystemImpl_MCRAW>(*mIoThreadPool, *mProcessingThreadPool, *mCache, *mDiskCache, options, draftScale, srcFile);
 
             mMountedFiles[mountId] = std::make_unique<Session>(dstPath, std::move(fs));
         }
@@ -598,4 +648,23 @@ std::optional<FileInfo> FuseFileSystemImpl_Win::getFileInfo(MountId mountId) {
     return std::nullopt;
 }
 
+void FuseFileSystemImpl_Win::setDiskCacheFolder(const std::string& path) {
+    mDiskCache->setFolder(path);
+}
+
+CacheStats FuseFileSystemImpl_Win::getCacheStats() const {
+    const auto reads = mProcessingThreadPool->getStats(TASK_PRIORITY_FOREGROUND);
+    const auto prefetches = mProcessingThreadPool->getStats(TASK_PRIORITY_PREFETCH);
+
+    return CacheStats{
+        mCache->size(),
+        mCache->capacity(),
+        mDiskCache->size(),
+        mDiskCache->capacity(),
+        reads.queued,
+        prefetches.queued,
+        reads.averageWaitMs
+    };
+}
+
 } // namespace motioncam
@@ -0,0 +1,254 @@
+//
+// Throughput of the sharded LRUCache against the single lock cache it replaced, with N threads reading a working
+// set larger than the cache so gets, claims, puts and evictions all happen. Also times the hit path alone, reading
+// cached DNGs front to back.
+//
+// Usage: motioncam-cache-benchmark [threads [operations per thread]]
+//
+
+#include "LRUCache.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+using namespace motioncam;
+
+namespace {
+    constexpr int DEFAULT_OPERATIONS = 200000;
+    constexpr int HIT_FRAMES = 8;
+    constexpr int NUM_FRAMES = 64;
+    constexpr int NUM_SEGMENTS = 80;            // A 20MB DNG in 256KB pages
+    constexpr size_t SEGMENT_SIZE = 256 * 1024;
+    constexpr size_t CACHE_SIZE = NUM_FRAMES * NUM_SEGMENTS * SEGMENT_SIZE / 2;
+
+    //
+    // The cache before sharding: one mutex and one condition variable for every key, hits reorder the list.
+    //
+
+    class SingleLockCache {
+    public:
+        explicit SingleLockCache(size_t maxSize) : mMaxSize(maxSize), mCurrentSize(0) {}
+
+        std::shared_ptr<std::vector<char>> get(const CacheKey& key, std::chrono::milliseconds timeout = std::chrono::seconds(2)) {
+            std::unique_lock<std::mutex> lock(mMutex);
+
+            bool success = mCondition.wait_for(lock, timeout, [this, &key] {
+                return mInProgress.find(key) == mInProgress.end();
+            });
+
+            if (!success)
+                return nullptr;
+
+            auto it = mCacheMap.find(key);
+            if (it == mCacheMap.end()) {
+                mInProgress.insert(key);
+                return nullptr;
+            }
+
+            mCacheList.splice(mCacheList.begin(), mCacheList, it->second);
+
+            return it->second->second;
+        }
+
+        std::shared_ptr<std::vector<char>> peek(const CacheKey& key) {
+            std::lock_guard<std::mutex> lock(mMutex);
+
+            auto it = mCacheMap.find(key);
+            if (it == mCacheMap.end())
+                return nullptr;
+
+            mCacheList.splice(mCacheList.begin(), mCacheList, it->second);
+
+            return it->second->second;
+        }
+
+        void put(const CacheKey& key, std::shared_ptr<std::vector<char>> value) {
+            std::lock_guard<std::mutex> lock(mMutex);
+
+            size_t valueSize = value->size();
+
+            auto it = mCacheMap.find(key);
+
+            if (it != mCacheMap.end()) {
+                mCurrentSize -= it->second->second->size();
+                mCurrentSize += valueSize;
+
+                mCacheList.splice(mCacheList.begin(), mCacheList, it->second);
+                it->second->second = value;
+            }
+            else {
+                while (!mCacheList.empty() && (mCurrentSize + valueSize > mMaxSize)) {
+                    auto last = mCacheList.back();
+                    mCurrentSize -= last.second->size();
+                    mCacheMap.erase(last.first);
+                    mCacheList.pop_back();
+                }
+
+                if (valueSize > mMaxSize) {
+                    mInProgress.erase(key);
+                    mCondition.notify_all();
+                    return;
+                }
+
+                mCacheList.emplace_front(key, value);
+                mCacheMap[key] = mCacheList.begin();
+                mCurrentSize += valueSize;
+            }
+
+            mInProgress.erase(key);
+            mCondition.notify_all();
+
+            spdlog::debug("Cache size is {} bytes", mCurrentSize);
+        }
+
+    private:
+        using CacheItem = std::pair<CacheKey, std::shared_ptr<std::vector<char>>>;
+        using CacheList = std::list<CacheItem>;
+        using CacheMap = std::unordered_map<CacheKey, typename CacheList::iterator, CacheKey::Hash>;
+
+        CacheList mCacheList;
+        CacheMap mCacheMap;
+        std::unordered_set<CacheKey, CacheKey::Hash> mInProgress;
+        size_t mMaxSize;
+        size_t mCurrentSize;
+        mutable std::mutex mMutex;
+        mutable std::condition_variable mCondition;
+    };
+
+    CacheKey makeKey(int frame, int segment) {
+        return CacheKey{ 1, 1, frame, segment };
+    }
+
+    // Runs fn(thread) on every thread at once, returns the wall time in milliseconds
+    double runThreads(int numThreads, const std::function<void(int)>& fn) {
+        std::vector<std::thread> threads;
+
+        const auto start = std::chrono::steady_clock::now();
+
+        for(int i = 0; i < numThreads; ++i)
+            threads.emplace_back(fn, i);
+
+        for(auto& thread : threads)
+            thread.join();
+
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    // Readers pick random segments, a miss claims the key and puts a value like the render path does. The values
+    // share one buffer, only their size matters to the cache.
+    template<typename Cache>
+    double contention(int numThreads, int operations, const std::shared_ptr<std::vector<char>>& value) {
+        Cache cache(CACHE_SIZE);
+
+        const double ms = runThreads(numThreads, [&](int thread) {
+            std::mt19937 random(thread + 1);
+            std::uniform_int_distribution<int> frame(0, NUM_FRAMES - 1);
+            std::uniform_int_distribution<int> segment(0, NUM_SEGMENTS - 1);
+
+            for(int i = 0; i < operations; ++i) {
+                const auto key = makeKey(frame(random), segment(random));
+
+                if(!cache.get(key))
+                    cache.put(key, value);
+            }
+        });
+
+        return numThreads * static_cast<double>(operations) / ms / 1000.0;
+    }
+
+    // Every segment of a few frames is cached, each thread reads them in order like sequential reads of the files.
+    // lookup is what the read path does on a hit. Returns wall time in nanoseconds per lookup across all threads.
+    template<typename Cache>
+    double hitPath(
+        int numThreads,
+        int operations,
+        const std::shared_ptr<std::vector<char>>& value,
+        const std::function<std::shared_ptr<std::vector<char>>(Cache&, const CacheKey&)>& lookup)
+    {
+        Cache cache(CACHE_SIZE);
+
+        for(int frame = 0; frame < HIT_FRAMES; ++frame) {
+            for(int segment = 0; segment < NUM_SEGMENTS; ++segment)
+                cache.put(makeKey(frame, segment), value);
+        }
+
+        const double ms = runThreads(numThreads, [&](int thread) {
+            for(int i = 0; i < operations; ++i) {
+                const int segment = i % NUM_SEGMENTS;
+                const int frame = (thread + i / NUM_SEGMENTS) % HIT_FRAMES;
+
+                if(!lookup(cache, makeKey(frame, segment)))
+                    std::abort();
+            }
+        });
+
+        return ms * 1e6 / (static_cast<double>(operations) * numThreads);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    const int maxThreads = argc > 1 ? std::atoi(argv[1]) : static_cast<int>((std::max)(std::thread::hardware_concurrency(), 1u));
+    const int operations = argc > 2 ? std::atoi(argv[2]) : DEFAULT_OPERATIONS;
+
+    if(maxThreads <= 0 || operations <= 0) {
+        std::cerr << "Threads and operations must be positive" << std::endl;
+        return 1;
+    }
+
+    const auto value = std::make_shared<std::vector<char>>(SEGMENT_SIZE);
+
+    std::cout << "Contention, " << operations << " get/put per thread over " << NUM_FRAMES * NUM_SEGMENTS
+              << " keys, cache holds half of them (million ops/s)" << std::endl;
+
+    // Powers of two up to the requested thread count
+    std::vector<int> threadCounts;
+
+    for(int threads = 1; threads < maxThreads; threads *= 2)
+        threadCounts.push_back(threads);
+
+    threadCounts.push_back(maxThreads);
+
+    for(int threads : threadCounts) {
+        const double before = contention<SingleLockCache>(threads, operations, value);
+        const double after = contention<LRUCache>(threads, operations, value);
+
+        std::cout << "  " << threads << " threads: single lock " << before << ", sharded " << after
+                  << " (" << after / before << "x)" << std::endl;
+    }
+
+    // Before, a hit was a get() followed by a put() to bump recency, two exclusive locks and a notify_all
+    std::cout << "Hit path, " << operations << " sequential segment reads per thread (ns per read)" << std::endl;
+
+    for(int threads : threadCounts) {
+        const double getPut = hitPath<SingleLockCache>(threads, operations, value, [&](SingleLockCache& cache, const CacheKey& key) {
+            auto data = cache.get(key);
+            cache.put(key, data);
+            return data;
+        });
+
+        const double singleLockPeek = hitPath<SingleLockCache>(threads, operations, value, [](SingleLockCache& cache, const CacheKey& key) {
+            return cache.peek(key);
+        });
+
+        const double shardedPeek = hitPath<LRUCache>(threads, operations, value, [](LRUCache& cache, const CacheKey& key) {
+            return cache.peek(key);
+        });
+
+        std::cout << "  " << threads << " threads: get+put " << getPut << ", single lock peek " << singleLockPeek
+                  << ", sharded peek " << shardedPeek << " (" << getPut / shardedPeek << "x)" << std::endl;
+    }
+
+    return 0;
+}
@@ -0,0 +1,103 @@
+//
+// Mounted DNGs are read as a header followed by fixed size pages of pixel data that don't line up with rows. Renders
+// every page of a frame on its own and checks they add up to the same bytes as a whole generateDng.
+//
+
+#include "SyntheticFrame.h"
+
+#include "Utils.h"
+
+#include <algorithm>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace motioncam;
+
+namespace {
+    constexpr size_t DNG_PAGE_SIZE = 256 * 1024; // Same as the file system
+    constexpr size_t ODD_PAGE_SIZE = 10007;      // Starts and ends pages on every kind of row offset
+
+    struct TestCase {
+        int width;
+        int height;
+        FileRenderOptions options;
+        int scale;
+    };
+
+    bool checkPages(const TestCase& test, size_t pageSize) {
+        const std::string name =
+            std::to_string(test.width) + "x" + std::to_string(test.height) + ", options " + std::to_string(test.options) +
+            ", scale " + std::to_string(test.scale) + ", " + std::to_string(pageSize) + " byte pages";
+
+        const auto config = testing::makeCameraConfiguration();
+        const auto metadata = testing::makeFrameMetadata(test.width, test.height);
+        auto data = testing::makeFrameData(test.width, test.height);
+
+        const auto layout = utils::getDngLayout(metadata, config, 30.0f, test.options, test.scale);
+        const auto expected = utils::generateDng(data, metadata, config, 30.0f, 0, test.options, test.scale);
+
+        if(expected->size() != layout.fileSize()) {
+            std::cerr << name << ": layout is " << layout.fileSize() << " bytes, the DNG " << expected->size() << std::endl;
+            return false;
+        }
+
+        if(pageSize % layout.rowBytes == 0) {
+            std::cerr << name << ": pages line up with rows (" << layout.rowBytes << " bytes), pick another size" << std::endl;
+            return false;
+        }
+
+        std::vector<char> actual(layout.fileSize());
+
+        const auto header = utils::generateDngHeader(metadata, config, 30.0f, 0, test.options, test.scale);
+
+        std::copy(header->begin(), header->end(), actual.begin());
+
+        for(size_t begin = layout.headerSize; begin < layout.fileSize(); begin += pageSize) {
+            const size_t end = (std::min)(begin + pageSize, layout.fileSize());
+
+            utils::renderDngBytes(
+                data, metadata, config, test.options, test.scale, layout,
+                begin - layout.headerSize, end - layout.headerSize,
+                reinterpret_cast<uint8_t*>(actual.data() + begin));
+        }
+
+        const auto mismatch = std::mismatch(expected->begin(), expected->end(), actual.begin());
+
+        if(mismatch.first != expected->end()) {
+            std::cerr << name << ": differs at byte " << (mismatch.first - expected->begin()) << std::endl;
+            return false;
+        }
+
+        std::cout << name << ": OK" << std::endl;
+
+        return true;
+    }
+}
+
+int main() {
+    const TestCase tests[] = {
+        { 4080, 3072, RENDER_OPT_NONE, 1 },
+        { 4080, 3072, RENDER_OPT_APPLY_VIGNETTE_CORRECTION, 1 },
+        { 1000, 752, RENDER_OPT_APPLY_VIGNETTE_CORRECTION | RENDER_OPT_NORMALIZE_SHADING_MAP, 1 },
+        { 1000, 752, RENDER_OPT_DRAFT, 2 },
+    };
+
+    bool success = true;
+
+    for(const auto& test : tests) {
+        for(const size_t pageSize : { DNG_PAGE_SIZE, ODD_PAGE_SIZE }) {
+            try {
+                success = checkPages(test, pageSize) && success;
+            }
+            catch(std::exception& e) {
+                std::cerr << test.width << "x" << test.height << ", " << pageSize << " byte pages: " << e.what() << std::endl;
+                success = false;
+            }
+        }
+    }
+
+    return success ? 0 : 1;
+}
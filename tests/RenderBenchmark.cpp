@@ -0,0 +1,237 @@
+//
+// Per-frame render time of the original scalar preprocessData and packing loops against the shipped render calls:
+// renderDngRows over the whole frame, renderDngBytes page by page as the file system calls it, and generateDng.
+// Also checks that the kernels produce the same bytes as the scalar loops.
+//
+// Usage: motioncam-render-benchmark [width height [iterations]]
+//
+
+#include "SyntheticFrame.h"
+
+#include "Kernels.h"
+#include "Utils.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace motioncam;
+
+namespace {
+    constexpr int DEFAULT_WIDTH = 4080;
+    constexpr int DEFAULT_HEIGHT = 3072;
+    constexpr int DEFAULT_ITERATIONS = 5;
+    constexpr size_t DNG_PAGE_SIZE = 256 * 1024; // Pages the file system renders a frame in
+
+    float getShadingMapValue(
+        float x, float y, int channel, const std::vector<std::vector<float>>& lensShadingMap, int mapWidth, int mapHeight)
+    {
+        x = std::max(0.0f, std::min(1.0f, x));
+        y = std::max(0.0f, std::min(1.0f, y));
+
+        const float mapX = x * (mapWidth - 1);
+        const float mapY = y * (mapHeight - 1);
+
+        const int x0 = static_cast<int>(std::floor(mapX));
+        const int y0 = static_cast<int>(std::floor(mapY));
+        const int x1 = std::min(x0 + 1, mapWidth - 1);
+        const int y1 = std::min(y0 + 1, mapHeight - 1);
+
+        const float wx = mapX - x0;
+        const float wy = mapY - y0;
+
+        const float valTop = lensShadingMap[channel][y0*mapWidth+x0] * (1.0f - wx) + lensShadingMap[channel][y0*mapWidth+x1] * wx;
+        const float valBottom = lensShadingMap[channel][y1*mapWidth+x0] * (1.0f - wx) + lensShadingMap[channel][y1*mapWidth+x1] * wx;
+
+        return valTop * (1.0f - wy) + valBottom * wy;
+    }
+
+    struct Levels {
+        std::array<float, 4> srcBlackLevel;
+        std::array<float, 4> dstBlackLevel;
+        std::array<float, 4> linear;
+        float dstWhiteLevel;
+    };
+
+    // Levels used with vignette correction on a 10-bit sensor, 4 extra bits of precision
+    Levels getLevels(const CameraConfiguration& config) {
+        Levels levels;
+
+        levels.srcBlackLevel = config.blackLevel;
+        levels.dstBlackLevel = config.blackLevel;
+        levels.dstWhiteLevel = 16383.0f;
+
+        for(int c = 0; c < 4; ++c) {
+            levels.linear[c] = 1.0f / (config.whiteLevel - config.blackLevel[c]);
+            levels.dstBlackLevel[c] *= 16;
+        }
+
+        return levels;
+    }
+
+    // The per-block loop preprocessData used before the kernels, four shading lookups per 2x2 block
+    void preprocessScalar(
+        const uint16_t* src, uint16_t* dst, int width, int height,
+        const CameraFrameMetadata& metadata, const std::array<uint8_t, 4>& cfa, const Levels& l)
+    {
+        const float scaleX = 1.0f / static_cast<float>(metadata.originalWidth);
+        const float scaleY = 1.0f / static_cast<float>(metadata.originalHeight);
+
+        for(int y = 0; y < height; y += 2) {
+            for(int x = 0; x < width; x += 2) {
+                const float sx = x * scaleX;
+                const float sy = y * scaleY;
+
+                std::array<float, 4> shading;
+
+                for(int c = 0; c < 4; ++c)
+                    shading[c] = getShadingMapValue(sx, sy, c, metadata.lensShadingMap, metadata.lensShadingMapWidth, metadata.lensShadingMapHeight);
+
+                const size_t offsets[4] = {
+                    static_cast<size_t>(y) * width + x,
+                    static_cast<size_t>(y) * width + x + 1,
+                    static_cast<size_t>(y + 1) * width + x,
+                    static_cast<size_t>(y + 1) * width + x + 1
+                };
+
+                for(int c = 0; c < 4; ++c) {
+                    const float p = std::max(0.0f, l.linear[c] * (src[offsets[c]] - l.srcBlackLevel[c]) * shading[cfa[c]]) *
+                                    (l.dstWhiteLevel - l.dstBlackLevel[c]);
+
+                    dst[offsets[c]] = static_cast<unsigned short>(std::clamp(std::round(p + l.dstBlackLevel[c]), 0.0f, l.dstWhiteLevel));
+                }
+            }
+        }
+    }
+
+    // The packing that followed preprocessData, 14 bits MSB-first like the DNG strips
+    void encodeScalar(const uint16_t* src, uint8_t* dst, int width, int height) {
+        for(int y = 0; y < height; y++) {
+            for(int x = 0; x < width; x += 4) {
+                const uint16_t p0 = src[0];
+                const uint16_t p1 = src[1];
+                const uint16_t p2 = src[2];
+                const uint16_t p3 = src[3];
+
+                dst[0] = p0 >> 6;
+                dst[1] = ((p0 & 0x3F) << 2) | (p1 >> 12);
+                dst[2] = (p1 >> 4) & 0xFF;
+                dst[3] = ((p1 & 0x0F) << 4) | (p2 >> 10);
+                dst[4] = (p2 >> 2) & 0xFF;
+                dst[5] = ((p2 & 0x03) << 6) | (p3 >> 8);
+                dst[6] = p3 & 0xFF;
+
+                src += 4;
+                dst += 7;
+            }
+        }
+    }
+
+    // Median of the iterations, in milliseconds
+    double timeIt(int iterations, const std::function<void()>& fn) {
+        std::vector<double> times;
+
+        for(int i = 0; i < iterations; ++i) {
+            const auto start = std::chrono::steady_clock::now();
+
+            fn();
+
+            times.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+        }
+
+        std::sort(times.begin(), times.end());
+
+        return times[times.size() / 2];
+    }
+}
+
+int main(int argc, char* argv[]) {
+    const int width = argc > 2 ? std::atoi(argv[1]) : DEFAULT_WIDTH;
+    const int height = argc > 2 ? std::atoi(argv[2]) : DEFAULT_HEIGHT;
+    const int iterations = argc > 3 ? std::atoi(argv[3]) : DEFAULT_ITERATIONS;
+
+    if(width <= 0 || height <= 0 || width % 4 != 0 || height % 4 != 0 || iterations <= 0) {
+        std::cerr << "Width and height must be positive multiples of 4" << std::endl;
+        return 1;
+    }
+
+    const auto config = testing::makeCameraConfiguration();
+    const auto metadata = testing::makeFrameMetadata(width, height);
+    auto data = testing::makeFrameData(width, height);
+
+    const std::array<uint8_t, 4> cfa = { 0, 1, 1, 2 };
+    const auto levels = getLevels(config);
+    const auto* src = reinterpret_cast<const uint16_t*>(data.data());
+
+    const auto layout = utils::getDngLayout(metadata, config, 30.0f, RENDER_OPT_APPLY_VIGNETTE_CORRECTION);
+
+    if(layout.rowBytes != static_cast<size_t>(width) * 14 / 8) {
+        std::cerr << "Expected 14-bit rows, the levels of the synthetic frame have changed" << std::endl;
+        return 1;
+    }
+
+    std::vector<uint16_t> linear(static_cast<size_t>(width) * height);
+    std::vector<uint8_t> before(layout.rowBytes * layout.height);
+    std::vector<uint8_t> after(before.size());
+
+    std::cout << "Frame " << width << "x" << height << ", " << iterations << " iterations, "
+              << kernels::activeInstructionSet() << " kernels" << std::endl;
+
+    const double scalarMs = timeIt(iterations, [&] {
+        preprocessScalar(src, linear.data(), width, height, metadata, cfa, levels);
+        encodeScalar(linear.data(), before.data(), width, height);
+    });
+
+    // Shading gains are cached per shading map, so every iteration after the first uses the cached table like the
+    // frames of a recording do
+    const double renderMs = timeIt(iterations, [&] {
+        utils::renderDngRows(
+            data, metadata, config, RENDER_OPT_APPLY_VIGNETTE_CORRECTION, 1, layout, 0, layout.height, after.data());
+    });
+
+    const auto rowsMismatch = std::mismatch(before.begin(), before.end(), after.begin());
+
+    // The file system renders a frame page by page as it is read
+    std::fill(after.begin(), after.end(), 0);
+
+    const double pagesMs = timeIt(iterations, [&] {
+        for(size_t begin = 0; begin < after.size(); begin += DNG_PAGE_SIZE) {
+            const size_t end = (std::min)(begin + DNG_PAGE_SIZE, after.size());
+
+            utils::renderDngBytes(
+                data, metadata, config, RENDER_OPT_APPLY_VIGNETTE_CORRECTION, 1, layout, begin, end, after.data() + begin);
+        }
+    });
+
+    const auto pagesMismatch = std::mismatch(before.begin(), before.end(), after.begin());
+
+    const double dngMs = timeIt(iterations, [&] {
+        utils::generateDng(data, metadata, config, 30.0f, 0, RENDER_OPT_APPLY_VIGNETTE_CORRECTION);
+    });
+
+    std::cout << "  pixels, scalar (before):          " << scalarMs << " ms/frame\n"
+              << "  pixels, renderDngRows:            " << renderMs << " ms/frame (" << scalarMs / renderMs << "x)\n"
+              << "  pixels, renderDngBytes in pages:  " << pagesMs << " ms/frame (" << scalarMs / pagesMs << "x)\n"
+              << "  generateDng, whole frame:         " << dngMs << " ms/frame (" << scalarMs / dngMs << "x)" << std::endl;
+
+    for(const auto& [name, mismatch] : { std::make_pair("renderDngRows", rowsMismatch), std::make_pair("renderDngBytes", pagesMismatch) }) {
+        if(mismatch.first != before.end()) {
+            const auto i = mismatch.first - before.begin();
+
+            std::cerr << name << " differs from the scalar path at byte " << i
+                      << " (" << int(*mismatch.first) << " != " << int(*mismatch.second) << ")" << std::endl;
+
+            return 1;
+        }
+    }
+
+    std::cout << "  outputs are bit-exact" << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include "CameraFrameMetadata.h"
+#include "CameraMetadata.h"
+
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace motioncam {
+namespace testing {
+
+//
+// Frames that look like a recording without needing an MCRAW file, for tests and benchmarks of the render path.
+//
+
+inline CameraConfiguration makeCameraConfiguration(float whiteLevel = 1023.0f, const std::string& sensorArrangement = "rggb") {
+    CameraConfiguration config{};
+
+    config.blackLevel = { 64.0f, 64.0f, 64.0f, 64.0f };
+    config.whiteLevel = whiteLevel;
+    config.sensorArrangement = sensorArrangement;
+    config.colorIlluminant1 = "standarda";
+    config.colorIlluminant2 = "d65";
+    config.colorMatrix1 = { 1, 0, 0, 0, 1, 0, 0, 0, 1 };
+    config.colorMatrix2 = { 1, 0, 0, 0, 1, 0, 0, 0, 1 };
+    config.forwardMatrix1 = { 1, 0, 0, 0, 1, 0, 0, 0, 1 };
+    config.forwardMatrix2 = { 1, 0, 0, 0, 1, 0, 0, 0, 1 };
+    config.extraData.postProcessSettings.metadata.buildModel = "Synthetic";
+
+    return config;
+}
+
+// Shading map falls off towards the corners like a real lens
+inline CameraFrameMetadata makeFrameMetadata(int width, int height, int lensShadingMapWidth = 17, int lensShadingMapHeight = 13) {
+    CameraFrameMetadata metadata{};
+
+    metadata.width = width;
+    metadata.height = height;
+    metadata.originalWidth = width;
+    metadata.originalHeight = height;
+    metadata.asShotNeutral = { 0.5f, 1.0f, 0.6f };
+    metadata.iso = 100;
+    metadata.exposureTime = 1e7;
+    metadata.orientation = ScreenOrientation::LANDSCAPE;
+    metadata.lensShadingMapWidth = lensShadingMapWidth;
+    metadata.lensShadingMapHeight = lensShadingMapHeight;
+    metadata.lensShadingMap.resize(4);
+
+    for(int c = 0; c < 4; ++c) {
+        for(int y = 0; y < lensShadingMapHeight; ++y) {
+            for(int x = 0; x < lensShadingMapWidth; ++x) {
+                const float dx = x / float(lensShadingMapWidth - 1) - 0.5f;
+                const float dy = y / float(lensShadingMapHeight - 1) - 0.5f;
+
+                metadata.lensShadingMap[c].push_back(1.0f + 2.0f * (dx * dx + dy * dy) + 0.05f * c);
+            }
+        }
+    }
+
+    return metadata;
+}
+
+// Raw 16-bit samples between the black and white levels, with some values outside to exercise clamping
+inline std::vector<uint8_t> makeFrameData(int width, int height, float whiteLevel = 1023.0f, uint32_t seed = 1) {
+    std::vector<uint8_t> data(static_cast<size_t>(width) * height * sizeof(uint16_t));
+    std::mt19937 random(seed);
+    std::uniform_int_distribution<int> sample(0, static_cast<int>(whiteLevel) + 16);
+
+    auto* samples = reinterpret_cast<uint16_t*>(data.data());
+
+    for(size_t i = 0; i < static_cast<size_t>(width) * height; ++i)
+        samples[i] = static_cast<uint16_t>(sample(random));
+
+    return data;
+}
+
+} // namespace testing
+} // namespace motioncam